@@ -0,0 +1,971 @@
+/**********************************
+ * FILE NAME: MP1Bench.cpp
+ *
+ * DESCRIPTION: Benchmarks for the membership protocol.
+ * 				Built like Application, from the same sources with
+ * 				MP1Bench.cpp in place of Application.cpp, e.g.
+ * 				g++ -std=c++11 -O2 -o MP1Bench MP1Bench.cpp MP1Node.cpp EmulNet.cpp Log.cpp Params.cpp Member.cpp
+ *
+ * 				MP1Bench [--sizes 10,100,1000] [--time 700] [--fail 100:1,...] [--join 200:1,...]
+ * 				         [--leave 100:1,...] [--restart 300:1,...] [--drop 0.1] [--seed 1] [--threads 1] [--csv PREFIX] [--json FILE] [--nowire]
+ * 				         [--udp ROUNDS] [--ring VNODES]
+ * 				--fail T:K fails K random running nodes at time T, --join T:K holds K nodes back
+ * 				from the start up and starts them at time T. --leave T:K has K random running nodes
+ * 				leave through leaveGroup and finishUpThisNode at time T, measured like failures. --restart T:K has K random
+ * 				running nodes leave at time T and start again RESTARTDOWNTIME ticks later, the leave
+ * 				measured like a leave until then and the start like a join. With SNAPSHOTTIME set they
+ * 				restart from the snapshot written on leaving. Snapshot files are removed before and after each cluster run. Protocol settings come from the
+ * 				MP1_CONFIG file as for Application. --threads T > 1 runs the node loops of a tick on
+ * 				T threads, built with -pthread, and gives the same results as one thread.
+ * 				--udp ROUNDS first sends ROUNDS gossip messages to NUMTOGOSSIP sockets on loopback,
+ * 				one send call per target and then one per message, and prints messages per CPU second.
+ * 				--ring VNODES first times a HashRing of VNODES points per member: adding and removing a
+ * 				member, successors(key, RINGBENCHREPLICAS), and the most keys one member owns over the mean.
+ * 				EmulNet matches addresses with strcmp, so past 255 nodes the ids that are multiples of
+ * 				256 share one mailbox and look partitioned to everyone else. It also counts messages
+ * 				per node id only up to MAX_NODES
+ **********************************/
+
+#include "MP1Node.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+
+/**
+ * Macros
+ */
+#define LEGACYSENDERSIZE	22		// 4 BYTE ENUM HEADER, 6 BYTE ADDRESS, 8 BYTE HEARTBEAT, 4 BYTE COUNT
+#define LEGACYENTRYSIZE	14		// RAW INT ID, SHORT PORT AND LONG HEARTBEAT
+#define WIREBENCHTIME	700		// TIME AT WHICH THE GOSSIP MESSAGE IS ENCODED
+#define BENCHTIME	700		// DEFAULT LENGTH OF A CLUSTER RUN, SAME AS APPLICATION
+#define BENCHMSGSIZE	(1 << 22)	// FULL LISTS OF LARGE CLUSTERS DO NOT FIT EMULNET'S USUAL 4000
+#define CHUNKSPERTHREAD	8		// WORK STEALING GRANULARITY, CHUNKS DEALT TO EACH THREAD PER PHASE
+#define UDPBENCHPORT	29000		// FIRST LOOPBACK PORT OF THE UDP BENCHMARK
+#define UDPBENCHSIZE	512		// BYTES PER UDP BENCHMARK MESSAGE, A GOSSIP OF ABOUT 100 MEMBERS
+#define RESTARTDOWNTIME	10		// TICKS A RESTARTED NODE IS DOWN, ABOUT AS LONG AS ITS LEAVE TAKES TO SPREAD
+#define RINGBENCHKEYS	1000000		// KEYS LOOKED UP PER RING SIZE
+#define RINGBENCHREPLICAS	3		// REPLICAS ASKED FOR PER LOOKUP
+
+/**
+ * STRUCT NAME: BenchEvent
+ *
+ * DESCRIPTION: count nodes fail, join or leave at time
+ */
+typedef struct BenchEvent {
+	int time;
+	int count;
+}BenchEvent;
+
+/**
+ * STRUCT NAME: BenchOptions
+ *
+ * DESCRIPTION: What to run, from the command line
+ */
+typedef struct BenchOptions {
+	vector<int> sizes;
+	vector<BenchEvent> failures;
+	vector<BenchEvent> joins;
+	vector<BenchEvent> leaves;
+	vector<BenchEvent> restarts;
+	int totalTime;
+	double dropProb;
+	unsigned int seed;
+	int numThreads;
+	string csvPrefix;
+	string jsonPath;
+	bool wire;
+	int udpRounds;
+	int ringVirtualNodes;
+}BenchOptions;
+
+/**
+ * STRUCT NAME: RoundStats
+ *
+ * DESCRIPTION: One tick of a cluster run. falsePositives is the running total
+ */
+typedef struct RoundStats {
+	int time;
+	int alive;
+	long messages;
+	long bytes;
+	long cpuMicros;
+	long wallMicros;
+	int pendingJoins;
+	int pendingFailures;
+	long falsePositives;
+}RoundStats;
+
+/**
+ * STRUCT NAME: ClusterResult
+ *
+ * DESCRIPTION: Everything measured in one cluster run.
+ * 				Join latency runs from a node's start until every running node lists it,
+ * 				detection latency from a failure or leave until no running node lists the node
+ */
+typedef struct ClusterResult {
+	int numNodes;
+	vector<RoundStats> rounds;
+	vector<long> joinLatency;
+	int joinsUnconverged;
+	vector<long> detectLatency;
+	int failuresUndetected;
+	long falsePositives;
+	long messages;
+	long bytes;
+	long cpuMicros;
+	long wallMicros;
+	long inboxDrops;
+}ClusterResult;
+
+/**
+ * STRUCT NAME: PendingFailure
+ *
+ * DESCRIPTION: A failed or departed node that some running node still lists.
+ * 				listedBy marks the nodes that listed it when it failed and have not removed it yet
+ */
+typedef struct PendingFailure {
+	int node;
+	int time;
+	vector<char> listedBy;
+}PendingFailure;
+
+/**
+ * STRUCT NAME: PendingJoin
+ *
+ * DESCRIPTION: A started node that some running node does not list yet
+ */
+typedef struct PendingJoin {
+	int node;
+	int time;
+}PendingJoin;
+
+/**
+ * CLASS NAME: WorkStealingPool
+ *
+ * DESCRIPTION: Runs a task over the indices [0, count) on numThreads threads, the caller included.
+ * 				Each run cuts the range into chunks dealt round robin to one deque per thread.
+ * 				A thread takes chunks from the front of its own deque and, once that is empty,
+ * 				steals from the back of the others. run returns when every index is done
+ */
+class WorkStealingPool {
+private:
+	struct WorkQueue {
+		std::mutex lock;
+		deque<pair<int, int> > chunks;
+	};
+	int numThreads;
+	vector<WorkQueue *> queues;
+	vector<std::thread> workers;
+	std::mutex phaseLock;
+	std::condition_variable phaseStart;
+	std::condition_variable phaseDone;
+	long phase;
+	int busy;				// workers still in the current phase
+	bool stopping;
+	std::function<void(int)> task;
+
+	bool takeChunk(int self, pair<int, int> *chunk);
+	void work(int self);
+	void workerMain(int self);
+
+public:
+	WorkStealingPool(int numThreads);
+	~WorkStealingPool();
+	void run(int count, std::function<void(int)> task);
+};
+
+WorkStealingPool::WorkStealingPool(int numThreads) : numThreads(numThreads), phase(0), busy(0), stopping(false) {
+	for ( int i = 0; i < numThreads; i++ ) {
+		queues.push_back(new WorkQueue);
+	}
+	for ( int i = 1; i < numThreads; i++ ) {
+		workers.push_back(std::thread(&WorkStealingPool::workerMain, this, i));
+	}
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard<std::mutex> guard(phaseLock);
+		stopping = true;
+	}
+	phaseStart.notify_all();
+	for ( unsigned int i = 0; i < workers.size(); i++ ) {
+		workers[i].join();
+	}
+	for ( int i = 0; i < numThreads; i++ ) {
+		delete queues[i];
+	}
+}
+
+// own deque first, then the others starting with the next thread
+bool WorkStealingPool::takeChunk(int self, pair<int, int> *chunk) {
+	for ( int i = 0; i < numThreads; i++ ) {
+		WorkQueue *queue = queues[(self + i) % numThreads];
+		std::lock_guard<std::mutex> guard(queue->lock);
+		if ( queue->chunks.empty() ) {
+			continue;
+		}
+		if ( i == 0 ) {
+			*chunk = queue->chunks.front();
+			queue->chunks.pop_front();
+		} else {
+			*chunk = queue->chunks.back();
+			queue->chunks.pop_back();
+		}
+		return true;
+	}
+	return false;
+}
+
+void WorkStealingPool::work(int self) {
+	pair<int, int> chunk;
+	while ( takeChunk(self, &chunk) ) {
+		for ( int i = chunk.first; i < chunk.second; i++ ) {
+			task(i);
+		}
+	}
+}
+
+void WorkStealingPool::workerMain(int self) {
+	long seenPhase = 0;
+	while ( true ) {
+		{
+			std::unique_lock<std::mutex> guard(phaseLock);
+			phaseStart.wait(guard, [&] { return stopping || phase != seenPhase; });
+			if ( stopping ) {
+				return;
+			}
+			seenPhase = phase;
+		}
+		work(self);
+		{
+			std::lock_guard<std::mutex> guard(phaseLock);
+			busy--;
+		}
+		phaseDone.notify_one();
+	}
+}
+
+void WorkStealingPool::run(int count, std::function<void(int)> task) {
+	int chunkSize = max(1, count / (numThreads * CHUNKSPERTHREAD));
+	for ( int first = 0, chunk = 0; first < count; first += chunkSize, chunk++ ) {
+		queues[chunk % numThreads]->chunks.push_back(make_pair(first, min(count, first + chunkSize)));
+	}
+	{
+		std::lock_guard<std::mutex> guard(phaseLock);
+		this->task = task;
+		phase++;
+		busy = numThreads - 1;
+	}
+	phaseStart.notify_all();
+	work(0);
+	std::unique_lock<std::mutex> guard(phaseLock);
+	phaseDone.wait(guard, [&] { return busy == 0; });
+}
+
+/**
+ * FUNCTION NAME: wireBench
+ *
+ * DESCRIPTION: Encodes one full gossip message for a cluster of numMembers nodes and prints
+ * 				its size next to the size of the old raw int/short/long layout.
+ * 				Node i joined at time i/4 like in Application, so heartbeats are spread the same way
+ */
+void wireBench(Params *par, EmulNet *emulNet, Log *log, int numMembers) {
+	Member *member = new Member;
+	Address addr;
+	addr.init();
+	*(int *)(&addr.addr) = 1;
+
+	MP1Node *node = new MP1Node(member, par, emulNet, log, &addr);
+	par->globaltime = WIREBENCHTIME;
+	node->initThisNode(&addr);
+	member->heartbeat = 5 + WIREBENCHTIME;
+	for ( int id = 1; id <= numMembers; id++ ) {
+		node->addMemberToMembershipList(id, 0, 5 + WIREBENCHTIME - (id - 1) / 4, 0);
+	}
+
+	node->sendMembershipList();
+	GossipStats stats = node->getGossipStats(FULL_GOSSIP);
+	long compactBytes = stats.lastRoundBytes / stats.messages;
+	long legacyBytes = LEGACYSENDERSIZE + (long)numMembers * LEGACYENTRYSIZE;
+
+	printf("%8d %12ld %12ld %8.2fx\n", numMembers, legacyBytes, compactBytes, (double)legacyBytes / compactBytes);
+
+	emulNet->ENcleanup();
+	delete node;
+	delete member;
+}
+
+/**
+ * FUNCTION NAME: cpuMicros
+ *
+ * DESCRIPTION: CPU time used by the process so far
+ */
+long cpuMicros() {
+	struct timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+/**
+ * FUNCTION NAME: ringBench
+ *
+ * DESCRIPTION: Adds numMembers members with ids 1 to numMembers to a HashRing one at a time, looks up
+ * 				RINGBENCHKEYS random keys, then removes the members again. Prints the CPU time of each
+ * 				add, remove and lookup, and how many keys the busiest member owns over the mean
+ */
+void ringBench(int numVirtual, int numMembers) {
+	HashRing ring;
+	FastRandom random;
+	vector<Address> replicas;
+	vector<int> owned(numMembers, 0);
+
+	ring.reset(numVirtual);
+	long start = cpuMicros();
+	for ( int id = 1; id <= numMembers; id++ ) {
+		ring.add(id, 0);
+	}
+	long addMicros = cpuMicros() - start;
+
+	start = cpuMicros();
+	for ( int i = 0; i < RINGBENCHKEYS; i++ ) {
+		ring.successors(random.next(), RINGBENCHREPLICAS, &replicas);
+		owned[*(int *)(&replicas[0].addr) - 1]++;
+	}
+	long lookupMicros = cpuMicros() - start;
+
+	start = cpuMicros();
+	for ( int id = 1; id <= numMembers; id++ ) {
+		ring.remove(id, 0);
+	}
+	long removeMicros = cpuMicros() - start;
+
+	printf("%8d %7d %10.2f %10.2f %10.1f %9.2f\n", numMembers, ring.virtualNodes(), (double)addMicros / numMembers,
+			(double)removeMicros / numMembers, lookupMicros * 1000.0 / RINGBENCHKEYS,
+			*max_element(owned.begin(), owned.end()) * (double)numMembers / RINGBENCHKEYS);
+}
+
+/**
+ * FUNCTION NAME: wallMicros
+ *
+ * DESCRIPTION: Elapsed time on a clock that only moves forward
+ */
+long wallMicros() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+#ifdef __linux__
+/**
+ * FUNCTION NAME: udpBench
+ *
+ * DESCRIPTION: Sends numRounds messages from one loopback socket to NUMTOGOSSIP others and
+ * 				receives them, first with a transport call and a flush per target, the way a
+ * 				send per message works, then with one sendMany and flush per message.
+ * 				The receivers drain their sockets every INBOXBATCH messages, as a node does once
+ * 				a tick. Prints messages sent per second of CPU time, receiving included
+ */
+void udpBench(int numRounds) {
+	UdpTransport sender;
+	UdpTransport receivers[NUMTOGOSSIP];
+	Address from;
+	Address to[NUMTOGOSSIP];
+	Inbox *inbox = new Inbox();
+	InboxMessage batch[INBOXBATCH];
+	char data[UDPBENCHSIZE];
+	const char *modes[] = {"single", "batched"};
+
+	memset(data, 0, sizeof(data));
+	UdpTransport::parseAddress("127.0.0.1:0", &from);
+	*(unsigned short *)(&from.addr[4]) = UDPBENCHPORT;
+	vector<Address> seeds(1, from);
+	if ( !sender.open(&from, seeds) ) {
+		perror("udp bench");
+		return;
+	}
+	for ( int k = 0; k < NUMTOGOSSIP; k++ ) {
+		to[k] = from;
+		*(unsigned short *)(&to[k].addr[4]) = UDPBENCHPORT + 1 + k;
+		if ( !receivers[k].open(&to[k], seeds) ) {
+			perror("udp bench");
+			return;
+		}
+	}
+
+	printf("udp loopback, %d targets, %d byte messages\n", NUMTOGOSSIP, UDPBENCHSIZE);
+	printf("%8s %10s %10s %12s\n", "sends", "messages", "received", "msgs/cpu s");
+	for ( int mode = 0; mode < 2; mode++ ) {
+		long received = 0;
+		long start = cpuMicros();
+		for ( int r = 0; r < numRounds; r++ ) {
+			if ( mode == 0 ) {
+				for ( int k = 0; k < NUMTOGOSSIP; k++ ) {
+					sender.send(&from, &to[k], data, sizeof(data));
+					sender.flush();
+				}
+			} else {
+				sender.sendMany(&from, to, NUMTOGOSSIP, data, sizeof(data));
+				sender.flush();
+			}
+			if ( r % INBOXBATCH != INBOXBATCH - 1 && r != numRounds - 1 ) {
+				continue;
+			}
+			for ( int k = 0; k < NUMTOGOSSIP; k++ ) {
+				received += receivers[k].recv(&to[k], inbox);
+				int numMessages;
+				while ( (numMessages = inbox->drain(batch, INBOXBATCH)) > 0 ) {
+					for ( int i = 0; i < numMessages; i++ ) {
+						free(batch[i].data);
+					}
+				}
+			}
+		}
+		long elapsed = max(1L, cpuMicros() - start);
+		long sent = (long)numRounds * NUMTOGOSSIP;
+		printf("%8s %10ld %10ld %12.0f\n", modes[mode], sent, received, sent * 1e6 / elapsed);
+	}
+	printf("\n");
+	delete inbox;
+}
+#endif
+
+/**
+ * FUNCTION NAME: lists
+ *
+ * DESCRIPTION: True if observer has member on its membership list
+ */
+bool lists(MP1Node *observer, MP1Node *member) {
+	Address *addr = &member->getMemberNode()->addr;
+	int id;
+	short port;
+	memcpy(&id, &addr->addr[0], sizeof(int));
+	memcpy(&port, &addr->addr[4], sizeof(short));
+	return observer->findMember(id, port) != NULL;
+}
+
+/**
+ * FUNCTION NAME: removals
+ *
+ * DESCRIPTION: How many members node has removed, for any reason
+ */
+long removals(MP1Node *node) {
+	return node->getTransitionStats(MEMBER_ALIVE, MEMBER_FAILED).count +
+	       node->getTransitionStats(MEMBER_SUSPECT, MEMBER_FAILED).count +
+	       node->getTransitionStats(MEMBER_ALIVE, MEMBER_LEFT).count +
+	       node->getTransitionStats(MEMBER_SUSPECT, MEMBER_LEFT).count;
+}
+
+/**
+ * FUNCTION NAME: clusterBench
+ *
+ * DESCRIPTION: Runs numNodes nodes through the emulated network the way Application does,
+ * 				with the failures, joins and leaves of the options, and measures every tick.
+ * 				Failures and leaves never hit the introducer so scheduled joins can still get in.
+ * 				With more than one thread only the node loops run in parallel: nodes buffer their
+ * 				sends, and the outboxes are flushed in the sequential loop order afterwards, so
+ * 				EmulNet sees the same messages in the same order and draws the same drops
+ */
+ClusterResult clusterBench(BenchOptions *options, int numNodes) {
+	ClusterResult result;
+	vector<MP1Node *> nodes;
+	vector<int> startTime(numNodes, -1);
+	vector<PendingJoin> pendingJoins;
+	vector<PendingFailure> pendingFailures;
+	long trueRemovals = 0;
+	long sentMessages = 0;
+	long sentBytes = 0;
+	int numJoining = 0;
+	vector<int> looping;			// nodes whose nodeLoop runs this tick, in loop order
+	WorkStealingPool *pool = options->numThreads > 1 ? new WorkStealingPool(options->numThreads) : NULL;
+
+	srand(options->seed);
+	Params *par = new Params();
+	par->MAX_NNB = numNodes;
+	par->EN_GPSZ = numNodes;
+	par->MAX_MSG_SIZE = BENCHMSGSIZE;
+	par->SINGLE_FAILURE = 0;
+	par->DROP_MSG = options->dropProb > 0;
+	par->dropmsg = options->dropProb > 0;
+	par->MSG_DROP_PROB = options->dropProb;
+	par->STEP_RATE = .25;
+	par->globaltime = 0;
+	EmulNet *emulNet = new EmulNet(par);
+	Log *log = new Log(par);
+
+	for ( unsigned int i = 0; i < options->joins.size(); i++ ) {
+		numJoining += options->joins[i].count;
+	}
+	numJoining = min(numJoining, numNodes - 1);
+	for ( int i = 0; i < numNodes; i++ ) {
+		Member *member = new Member;
+		Address addr;
+		emulNet->ENinit(&addr, par->PORTNUM);
+		nodes.push_back(new MP1Node(member, par, emulNet, log, &addr));
+		nodes.back()->setBufferSends(pool != NULL);
+		remove(nodes.back()->snapshotPath().c_str());		// left by an earlier run
+		if ( i < numNodes - numJoining ) {
+			startTime[i] = (int)(par->STEP_RATE * i);
+		}
+	}
+	int nextJoiner = numNodes - numJoining;
+	for ( unsigned int i = 0; i < options->joins.size(); i++ ) {
+		for ( int k = 0; k < options->joins[i].count && nextJoiner < numNodes; k++ ) {
+			startTime[nextJoiner++] = options->joins[i].time;
+		}
+	}
+
+	result.numNodes = numNodes;
+	result.cpuMicros = 0;
+	result.wallMicros = 0;
+	for ( par->globaltime = 0; par->globaltime < options->totalTime; ++par->globaltime ) {
+		int time = par->getcurrtime();
+		RoundStats round;
+
+		for ( int i = 0; i < numNodes; i++ ) {
+			if ( startTime[i] >= 0 && time > startTime[i] && !nodes[i]->getMemberNode()->bFailed ) {
+				nodes[i]->recvLoop();
+			}
+		}
+		long cpuStart = cpuMicros();
+		long wallStart = wallMicros();
+		looping.clear();
+		for ( int i = numNodes - 1; i >= 0; i-- ) {
+			if ( time == startTime[i] ) {
+				for ( unsigned int f = 0; f < pendingFailures.size(); f++ ) {
+					if ( pendingFailures[f].node == i ) {		// back before everyone saw it leave
+						pendingFailures[f] = pendingFailures.back();
+						pendingFailures.pop_back();
+						break;
+					}
+				}
+				nodes[i]->nodeStart((char *)"", par->PORTNUM);
+				PendingJoin join = {i, time};
+				pendingJoins.push_back(join);
+			} else if ( startTime[i] >= 0 && time > startTime[i] && !nodes[i]->getMemberNode()->bFailed ) {
+				if ( pool == NULL ) {
+					nodes[i]->nodeLoop();
+				} else {
+					looping.push_back(i);
+				}
+			}
+		}
+		if ( pool != NULL ) {
+			pool->run(looping.size(), [&](int k) { nodes[looping[k]]->nodeLoop(); });
+			for ( int i = numNodes - 1; i >= 0; i-- ) {
+				nodes[i]->flushSends();
+			}
+		}
+		round.cpuMicros = cpuMicros() - cpuStart;
+		round.wallMicros = wallMicros() - wallStart;
+
+		for ( unsigned int e = 0; e < options->failures.size() + options->leaves.size() + options->restarts.size(); e++ ) {
+			bool leaving = e >= options->failures.size();
+			bool restarting = e >= options->failures.size() + options->leaves.size();
+			BenchEvent *event = restarting ? &options->restarts[e - options->failures.size() - options->leaves.size()] :
+			                    leaving ? &options->leaves[e - options->failures.size()] : &options->failures[e];
+			if ( event->time != time ) {
+				continue;
+			}
+			for ( int k = 0; k < event->count; k++ ) {
+				vector<int> candidates;
+				for ( int i = 1; i < numNodes; i++ ) {
+					if ( startTime[i] >= 0 && startTime[i] <= time && !nodes[i]->getMemberNode()->bFailed ) {
+						candidates.push_back(i);
+					}
+				}
+				if ( candidates.empty() ) {
+					break;
+				}
+				PendingFailure failure;
+				failure.node = candidates[rand() % candidates.size()];
+				failure.time = time;
+				failure.listedBy.assign(numNodes, 0);
+				for ( int i = 0; i < numNodes; i++ ) {
+					failure.listedBy[i] = i != failure.node && startTime[i] >= 0 && startTime[i] <= time &&
+					                      !nodes[i]->getMemberNode()->bFailed && lists(nodes[i], nodes[failure.node]);
+				}
+				if ( leaving ) {
+					nodes[failure.node]->leaveGroup();		// says goodbye, then stops like a failed node
+					nodes[failure.node]->finishUpThisNode();
+				}
+				nodes[failure.node]->getMemberNode()->bFailed = true;
+				if ( restarting ) {
+					startTime[failure.node] = time + RESTARTDOWNTIME;
+				}
+				log->LOG(&nodes[failure.node]->getMemberNode()->addr, leaving ? "Node left at time=%d" : "Node failed at time=%d", time);
+				pendingFailures.push_back(failure);
+			}
+		}
+
+		// a join has converged once every running node lists the new node
+		for ( unsigned int j = 0; j < pendingJoins.size(); ) {
+			MP1Node *joiner = nodes[pendingJoins[j].node];
+			bool converged = true;
+			if ( !joiner->getMemberNode()->bFailed ) {
+				for ( int i = 0; i < numNodes && converged; i++ ) {
+					if ( i != pendingJoins[j].node && startTime[i] >= 0 && startTime[i] <= time &&
+					     !nodes[i]->getMemberNode()->bFailed && !lists(nodes[i], joiner) ) {
+						converged = false;
+					}
+				}
+			}
+			if ( converged ) {
+				if ( !joiner->getMemberNode()->bFailed ) {
+					result.joinLatency.push_back(time - pendingJoins[j].time);
+				}
+				pendingJoins[j] = pendingJoins.back();
+				pendingJoins.pop_back();
+				continue;
+			}
+			j++;
+		}
+
+		// a failure is detected once no running node lists the failed node
+		for ( unsigned int f = 0; f < pendingFailures.size(); ) {
+			PendingFailure *failure = &pendingFailures[f];
+			MP1Node *failed = nodes[failure->node];
+			bool detected = true;
+			for ( int i = 0; i < numNodes; i++ ) {
+				if ( i == failure->node || startTime[i] < 0 || startTime[i] > time || nodes[i]->getMemberNode()->bFailed ) {
+					continue;
+				}
+				bool stillListed = lists(nodes[i], failed);
+				if ( failure->listedBy[i] && !stillListed ) {
+					trueRemovals++;
+					failure->listedBy[i] = 0;
+				}
+				detected = detected && !stillListed;
+			}
+			if ( detected ) {
+				result.detectLatency.push_back(time - failure->time);
+				pendingFailures[f] = pendingFailures.back();
+				pendingFailures.pop_back();
+				continue;
+			}
+			f++;
+		}
+
+		long allRemovals = 0;
+		long allMessages = 0;
+		long allBytes = 0;
+		round.alive = 0;
+		for ( int i = 0; i < numNodes; i++ ) {
+			TrafficStats traffic = nodes[i]->getTrafficStats();
+			allRemovals += removals(nodes[i]);
+			allMessages += traffic.messages;
+			allBytes += traffic.bytes;
+			round.alive += startTime[i] >= 0 && startTime[i] <= time && !nodes[i]->getMemberNode()->bFailed;
+		}
+		round.time = time;
+		round.messages = allMessages - sentMessages;
+		round.bytes = allBytes - sentBytes;
+		round.pendingJoins = pendingJoins.size();
+		round.pendingFailures = pendingFailures.size();
+		round.falsePositives = allRemovals - trueRemovals;
+		sentMessages = allMessages;
+		sentBytes = allBytes;
+		result.cpuMicros += round.cpuMicros;
+		result.wallMicros += round.wallMicros;
+		result.rounds.push_back(round);
+	}
+
+	result.joinsUnconverged = pendingJoins.size();
+	result.failuresUndetected = pendingFailures.size();
+	result.falsePositives = result.rounds.empty() ? 0 : result.rounds.back().falsePositives;
+	result.messages = sentMessages;
+	result.bytes = sentBytes;
+	result.inboxDrops = 0;
+	for ( int i = 0; i < numNodes; i++ ) {
+		result.inboxDrops += nodes[i]->getInboxDrops();
+	}
+
+	for ( int i = 0; i < numNodes; i++ ) {
+		nodes[i]->leaveGroup();
+		nodes[i]->finishUpThisNode();
+	}
+	emulNet->ENcleanup();				// after the running nodes' LEAVEs, which nobody reads
+	for ( int i = 0; i < numNodes; i++ ) {
+		Member *member = nodes[i]->getMemberNode();
+		remove(nodes[i]->snapshotPath().c_str());
+		delete nodes[i];
+		delete member;
+	}
+	delete pool;
+	delete log;
+	delete emulNet;
+	delete par;
+	return result;
+}
+
+/**
+ * FUNCTION NAME: average
+ *
+ * DESCRIPTION: Mean of the values, 0 when there are none
+ */
+double average(vector<long> &values) {
+	long total = 0;
+	for ( unsigned int i = 0; i < values.size(); i++ ) {
+		total += values[i];
+	}
+	return values.empty() ? 0 : (double)total / values.size();
+}
+
+/**
+ * FUNCTION NAME: maximum
+ *
+ * DESCRIPTION: Largest of the values, 0 when there are none
+ */
+long maximum(vector<long> &values) {
+	return values.empty() ? 0 : *max_element(values.begin(), values.end());
+}
+
+/**
+ * FUNCTION NAME: messagesPerCpuSecond
+ *
+ * DESCRIPTION: Messages the cluster sent per second of CPU time spent in the node loops
+ */
+double messagesPerCpuSecond(ClusterResult *result) {
+	return result->messages * 1e6 / max(1L, result->cpuMicros);
+}
+
+/**
+ * FUNCTION NAME: printSummary
+ *
+ * DESCRIPTION: One line per cluster size, per round figures are averages over the run
+ */
+void printSummary(vector<ClusterResult> &results) {
+	printf("%8s %10s %12s %10s %11s %10s %9s %9s %9s %9s %6s\n", "nodes", "msgs/rnd", "bytes/rnd", "cpu us/rnd",
+	       "wall us/rnd", "msgs/cpu s", "join avg", "join max", "dtct avg", "dtct max", "falsep");
+	for ( unsigned int r = 0; r < results.size(); r++ ) {
+		ClusterResult *result = &results[r];
+		double numRounds = max((size_t)1, result->rounds.size());
+		printf("%8d %10.1f %12.1f %10.1f %11.1f %10.0f %9.1f %9ld %9.1f %9ld %6ld", result->numNodes,
+		       result->messages / numRounds, result->bytes / numRounds, result->cpuMicros / numRounds,
+		       result->wallMicros / numRounds, messagesPerCpuSecond(result), average(result->joinLatency), maximum(result->joinLatency),
+		       average(result->detectLatency), maximum(result->detectLatency), result->falsePositives);
+		if ( result->joinsUnconverged > 0 || result->failuresUndetected > 0 ) {
+			printf("  (%d joins unconverged, %d failures undetected)", result->joinsUnconverged, result->failuresUndetected);
+		}
+		if ( result->inboxDrops > 0 ) {
+			printf("  (%ld messages dropped by full inboxes)", result->inboxDrops);
+		}
+		printf("\n");
+	}
+}
+
+/**
+ * FUNCTION NAME: writeCSV
+ *
+ * DESCRIPTION: PREFIX_rounds.csv with a line per tick and PREFIX_summary.csv with a line per cluster size
+ */
+bool writeCSV(vector<ClusterResult> &results, string prefix) {
+	FILE *rounds = fopen((prefix + "_rounds.csv").c_str(), "w");
+	FILE *summary = fopen((prefix + "_summary.csv").c_str(), "w");
+	if ( rounds == NULL || summary == NULL ) {
+		if ( rounds != NULL ) fclose(rounds);
+		if ( summary != NULL ) fclose(summary);
+		return false;
+	}
+
+	fprintf(rounds, "nodes,time,alive,messages,bytes,cpu_us,pending_joins,pending_failures,false_positives,wall_us\n");
+	fprintf(summary, "nodes,rounds,messages,bytes,cpu_us,joins,join_avg,join_max,joins_unconverged,"
+	                 "failures,detect_avg,detect_max,failures_undetected,false_positives,wall_us,inbox_drops,"
+	                 "msgs_per_cpu_s\n");
+	for ( unsigned int r = 0; r < results.size(); r++ ) {
+		ClusterResult *result = &results[r];
+		for ( unsigned int i = 0; i < result->rounds.size(); i++ ) {
+			RoundStats *round = &result->rounds[i];
+			fprintf(rounds, "%d,%d,%d,%ld,%ld,%ld,%d,%d,%ld,%ld\n", result->numNodes, round->time, round->alive,
+			        round->messages, round->bytes, round->cpuMicros, round->pendingJoins,
+			        round->pendingFailures, round->falsePositives, round->wallMicros);
+		}
+		fprintf(summary, "%d,%zu,%ld,%ld,%ld,%zu,%.2f,%ld,%d,%zu,%.2f,%ld,%d,%ld,%ld,%ld,%.0f\n", result->numNodes,
+		        result->rounds.size(), result->messages, result->bytes, result->cpuMicros,
+		        result->joinLatency.size(), average(result->joinLatency), maximum(result->joinLatency),
+		        result->joinsUnconverged, result->detectLatency.size(), average(result->detectLatency),
+		        maximum(result->detectLatency), result->failuresUndetected, result->falsePositives,
+		        result->wallMicros, result->inboxDrops, messagesPerCpuSecond(result));
+	}
+	fclose(rounds);
+	fclose(summary);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: writeJSON
+ *
+ * DESCRIPTION: The summary and rounds of every cluster size in one document
+ */
+bool writeJSON(vector<ClusterResult> &results, string path) {
+	FILE *fp = fopen(path.c_str(), "w");
+	if ( fp == NULL ) {
+		return false;
+	}
+
+	fprintf(fp, "{\"runs\": [");
+	for ( unsigned int r = 0; r < results.size(); r++ ) {
+		ClusterResult *result = &results[r];
+		fprintf(fp, "%s\n {\"nodes\": %d, \"messages\": %ld, \"bytes\": %ld, \"cpu_us\": %ld, \"wall_us\": %ld,",
+		        r ? "," : "", result->numNodes, result->messages, result->bytes, result->cpuMicros, result->wallMicros);
+		fprintf(fp, " \"join_avg\": %.2f, \"join_max\": %ld, \"joins_unconverged\": %d,",
+		        average(result->joinLatency), maximum(result->joinLatency), result->joinsUnconverged);
+		fprintf(fp, " \"detect_avg\": %.2f, \"detect_max\": %ld, \"failures_undetected\": %d, \"false_positives\": %ld,"
+		        " \"inbox_drops\": %ld, \"msgs_per_cpu_s\": %.0f,", average(result->detectLatency),
+		        maximum(result->detectLatency), result->failuresUndetected, result->falsePositives,
+		        result->inboxDrops, messagesPerCpuSecond(result));
+		fprintf(fp, "\n  \"rounds\": [");
+		for ( unsigned int i = 0; i < result->rounds.size(); i++ ) {
+			RoundStats *round = &result->rounds[i];
+			fprintf(fp, "%s\n   {\"time\": %d, \"alive\": %d, \"messages\": %ld, \"bytes\": %ld, \"cpu_us\": %ld,"
+			        " \"wall_us\": %ld, \"pending_joins\": %d, \"pending_failures\": %d, \"false_positives\": %ld}",
+			        i ? "," : "", round->time, round->alive, round->messages, round->bytes, round->cpuMicros,
+			        round->wallMicros, round->pendingJoins, round->pendingFailures, round->falsePositives);
+		}
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: parseEvents
+ *
+ * DESCRIPTION: Reads a T:K,T:K,... schedule. Returns false on anything else
+ */
+bool parseEvents(const char *spec, vector<BenchEvent> *events) {
+	events->clear();
+	while ( *spec != '\0' ) {
+		BenchEvent event;
+		int length;
+		if ( sscanf(spec, "%d:%d%n", &event.time, &event.count, &length) != 2 || event.time < 0 || event.count < 0 ) {
+			return false;
+		}
+		events->push_back(event);
+		spec += length;
+		if ( *spec == ',' ) {
+			spec++;
+		}
+	}
+	return true;
+}
+
+/**
+ * FUNCTION NAME: parseSizes
+ *
+ * DESCRIPTION: Reads a N,N,... list of cluster sizes
+ */
+bool parseSizes(const char *spec, vector<int> *sizes) {
+	sizes->clear();
+	while ( *spec != '\0' ) {
+		int size;
+		int length;
+		if ( sscanf(spec, "%d%n", &size, &length) != 1 || size < 1 ) {
+			return false;
+		}
+		sizes->push_back(size);
+		spec += length;
+		if ( *spec == ',' ) {
+			spec++;
+		}
+	}
+	return !sizes->empty();
+}
+
+int main(int argc, char *argv[]) {
+	int sizes[] = {10, 100, 1000, 10000};
+	BenchOptions options;
+	options.sizes.push_back(10);
+	options.sizes.push_back(100);
+	options.sizes.push_back(1000);
+	parseEvents("100:1", &options.failures);
+	parseEvents("200:1", &options.joins);
+	options.totalTime = BENCHTIME;
+	options.dropProb = 0;
+	options.seed = 1;
+	options.numThreads = 1;
+	options.wire = true;
+	options.udpRounds = 0;
+	options.ringVirtualNodes = 0;
+
+	for ( int i = 1; i < argc; i++ ) {
+		string arg = argv[i];
+		bool ok = i + 1 < argc || arg == "--nowire";
+		if ( arg == "--nowire" ) options.wire = false;
+		else if ( !ok ) break;
+		else if ( arg == "--sizes" ) ok = parseSizes(argv[++i], &options.sizes);
+		else if ( arg == "--time" ) ok = (options.totalTime = atoi(argv[++i])) > 0;
+		else if ( arg == "--fail" ) ok = parseEvents(argv[++i], &options.failures);
+		else if ( arg == "--join" ) ok = parseEvents(argv[++i], &options.joins);
+		else if ( arg == "--leave" ) ok = parseEvents(argv[++i], &options.leaves);
+		else if ( arg == "--restart" ) ok = parseEvents(argv[++i], &options.restarts);
+		else if ( arg == "--drop" ) options.dropProb = atof(argv[++i]);
+		else if ( arg == "--seed" ) options.seed = strtoul(argv[++i], NULL, 10);
+		else if ( arg == "--threads" ) ok = (options.numThreads = atoi(argv[++i])) > 0;
+		else if ( arg == "--csv" ) options.csvPrefix = argv[++i];
+		else if ( arg == "--json" ) options.jsonPath = argv[++i];
+		else if ( arg == "--udp" ) ok = (options.udpRounds = atoi(argv[++i])) > 0;
+		else if ( arg == "--ring" ) ok = (options.ringVirtualNodes = atoi(argv[++i])) > 0;
+		else ok = false;
+		if ( !ok ) {
+			cout << "bad argument " << arg << ", see the top of MP1Bench.cpp" << endl;
+			return 1;
+		}
+	}
+
+	if ( options.wire ) {
+		Params *par = new Params();
+		par->MAX_NNB = 10;
+		par->EN_GPSZ = 10;
+		par->MAX_MSG_SIZE = 4000;
+		par->SINGLE_FAILURE = 0;
+		par->DROP_MSG = 0;
+		par->dropmsg = 0;
+		par->MSG_DROP_PROB = 0;
+		par->STEP_RATE = .25;
+		par->globaltime = 0;
+		EmulNet *emulNet = new EmulNet(par);
+		Log *log = new Log(par);
+
+		printf("%8s %12s %12s %9s\n", "members", "raw bytes", "wire bytes", "ratio");
+		for ( unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ) {
+			wireBench(par, emulNet, log, sizes[i]);
+		}
+		printf("\n");
+
+		delete log;
+		delete emulNet;
+		delete par;
+	}
+
+#ifdef __linux__
+	if ( options.udpRounds > 0 ) {
+		udpBench(options.udpRounds);
+	}
+#endif
+
+	if ( options.ringVirtualNodes > 0 ) {
+		printf("%8s %7s %10s %10s %10s %9s\n", "members", "vnodes", "add us", "remove us", "lookup ns", "max/mean");
+		for ( unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ) {
+			ringBench(options.ringVirtualNodes, sizes[i]);
+		}
+		printf("\n");
+	}
+
+	vector<ClusterResult> results;
+	for ( unsigned int i = 0; i < options.sizes.size(); i++ ) {
+		results.push_back(clusterBench(&options, options.sizes[i]));
+	}
+	printSummary(results);
+	if ( !options.csvPrefix.empty() && !writeCSV(results, options.csvPrefix) ) {
+		cout << "could not write " << options.csvPrefix << "_*.csv" << endl;
+		return 1;
+	}
+	if ( !options.jsonPath.empty() && !writeJSON(results, options.jsonPath) ) {
+		cout << "could not write " << options.jsonPath << endl;
+		return 1;
+	}
+	return 0;
+}
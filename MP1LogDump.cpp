@@ -0,0 +1,66 @@
+/**********************************
+ * FILE NAME: MP1LogDump.cpp
+ *
+ * DESCRIPTION: Turns the BINARYLOGFILE written by a -DMP1BINARYLOG build back into the
+ * 				join and removal lines Log writes to dbg.log, in time order.
+ * 				g++ -std=c++11 -O2 -o MP1LogDump MP1LogDump.cpp
+ * 				MP1LogDump [dbg.bin] [out], out defaults to standard output
+ **********************************/
+
+#include "MP1Node.h"
+
+/**
+ * FUNCTION NAME: recordBefore
+ *
+ * DESCRIPTION: Sort order of the records, by time only so each node keeps its own order
+ */
+bool recordBefore(const LogRecord &first, const LogRecord &second) {
+	return first.time < second.time;
+}
+
+/**
+ * FUNCTION NAME: printAddress
+ *
+ * DESCRIPTION: The address the way Log prints it
+ */
+void printAddress(FILE *out, const char *addr) {
+	short port;
+	memcpy(&port, &addr[4], sizeof(short));
+	fprintf(out, "%d.%d.%d.%d:%d", addr[0], addr[1], addr[2], addr[3], port);
+}
+
+int main(int argc, char *argv[]) {
+	const char *inPath = argc > 1 ? argv[1] : BINARYLOGFILE;
+	FILE *in = fopen(inPath, "rb");
+	FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+	int header[2];
+	vector<LogRecord> records;
+	LogRecord record;
+
+	if ( in == NULL || out == NULL ) {
+		cout << "could not open " << (in == NULL ? inPath : argv[2]) << endl;
+		return 1;
+	}
+	if ( fread(header, sizeof(header), 1, in) != 1 || header[0] != BINARYLOGMAGIC || header[1] != (int)sizeof(LogRecord) ) {
+		cout << inPath << " was not written by this build's MP1Node" << endl;
+		return 1;
+	}
+	while ( fread(&record, sizeof(record), 1, in) == 1 ) {
+		records.push_back(record);
+	}
+	fclose(in);
+
+	stable_sort(records.begin(), records.end(), recordBefore);
+	for ( unsigned int i = 0; i < records.size(); i++ ) {
+		fprintf(out, "\n ");
+		printAddress(out, records[i].observer);
+		fprintf(out, " [%d] Node ", records[i].time);
+		printAddress(out, records[i].subject);
+		fprintf(out, " %s at time %d", records[i].kind == NODE_ADDED_RECORD ? "joined" : "removed", records[i].time);
+	}
+
+	if ( out != stdout ) {
+		fclose(out);
+	}
+	return 0;
+}
@@ -11,32 +11,69 @@
  * Note: You can change/add any functions in MP1Node.{h,cpp}
  */
 
+std::mutex MP1Node::logLock;
+
 /**
  * Overloaded Constructor of the MP1Node class
  * You can add new members to the class if you think it
  * is necessary for your logic to work
  */
-MP1Node::MP1Node(Member *member, Params *params, EmulNet *emul, Log *log, Address *address) {
+MP1Node::MP1Node(Member *member, Params *params, EmulNet *emul, Log *log, Address *address)
+	: MP1Node(member, params, new EmulNetTransport(emul), log, address) {
+	this->ownTransport.reset(this->transport);
+}
+
+/**
+ * Constructor for a node on any Transport, which the caller keeps and deletes
+ */
+MP1Node::MP1Node(Member *member, Params *params, Transport *transport, Log *log, Address *address) {
 	for( int i = 0; i < 6; i++ ) {
 		NULLADDR[i] = 0;
 	}
 	this->memberNode = member;
-	this->emulNet = emul;
+	this->transport = transport;
 	this->log = log;
 	this->par = params;
 	this->memberNode->addr = *address;
-
+	this->memberTable.attach(&memberNode->memberList);
+	memset(this->gossipStats, 0, sizeof(this->gossipStats));
+	memset(&this->traffic, 0, sizeof(this->traffic));
+#ifdef MP1METRICS
+	memset(&this->metrics, 0, sizeof(this->metrics));
+#endif
+#ifdef MP1BINARYLOG
+	this->logRing = new LogRing();
+	BinaryLogWriter::instance().attach(this->logRing);
+#endif
+	this->bufferSends = false;
+	this->tombstones.attach(&tombstoneList);
+	memset(this->transitions, 0, sizeof(this->transitions));
+	this->config = sharedConfig();
+	this->ring.reset(this->config.ringVirtualNodes);
+	this->probe.active = false;
+	this->probeSeq = 0;
+	this->incarnation = 0;
+	this->joinAttempts = 0;
+	this->joinSentAt = 0;
+	// distinct per node, and still follows srand() so a seeded run replays
+	this->random.seed(((unsigned long long)(unsigned int)rand() << 32) ^ *(unsigned int *)(&address->addr));
 }
 
 /**
  * Destructor of the MP1Node class
  */
-MP1Node::~MP1Node() {}
+MP1Node::~MP1Node() {
+	inbox.discard();
+#ifdef MP1BINARYLOG
+	BinaryLogWriter::instance().detach(logRing);
+	delete logRing;
+#endif
+}
 
 /**
  * FUNCTION NAME: recvLoop
  *
- * DESCRIPTION: This function receives message from the network and pushes into the queue
+ * DESCRIPTION: This function receives message from the network and pushes into the inbox
  * 				This function is called by a node to receive messages currently waiting for it
  */
 int MP1Node::recvLoop() {
@@ -44,18 +81,21 @@ int MP1Node::recvLoop() {
     	return false;
     }
     else {
-    	return emulNet->ENrecv(&(memberNode->addr), enqueueWrapper, NULL, 1, &(memberNode->mp1q));
+    	return transport->recv(&(memberNode->addr), &inbox);
     }
 }
 
 /**
  * FUNCTION NAME: enqueueWrapper
  *
- * DESCRIPTION: Enqueue the message from Emulnet into the queue
+ * DESCRIPTION: Enqueue the message from Emulnet into the inbox, a full inbox drops it
  */
 int MP1Node::enqueueWrapper(void *env, char *buff, int size) {
-	Queue q;
-	return q.enqueue((queue<q_elt> *)env, (void *)buff, size);
+	if ( !((Inbox *)env)->push(buff, size) ) {
+		free(buff);
+		return false;
+	}
+	return true;
 }
 
 /**
@@ -106,9 +146,10 @@ int MP1Node::initThisNode(Address *joinaddr) {
 	memberNode->inGroup = false;
     // node is up!
 	memberNode->nnb = 0;
-	memberNode->pingCounter = TFAIL;
+	memberNode->pingCounter = config.tFail;
 	memberNode->timeOutCounter = -1;
     memberNode->heartbeat = 5;
+    incarnation = 0;        // a restart starts over, the group tells it which incarnation it had
 
 
     initMemberListTable(memberNode);
@@ -122,12 +163,24 @@ int MP1Node::initThisNode(Address *joinaddr) {
  * DESCRIPTION: Join the distributed system
  */
 int MP1Node::introduceSelfToGroup(Address *joinaddr) {
-	MessageHdr *msg;
 #ifdef DEBUGLOG
     static char s[1024];
 #endif
 
-    if ( 0 == memcmp((char *)&(memberNode->addr.addr), (char *)&(joinaddr->addr), sizeof(memberNode->addr.addr))) {
+    // any introducer but this node will do. starting at a random one spreads a mass join
+    // over all of them, later attempts go round the rest
+    transport->getSeedAddresses(config.joinSeeds, &seeds);
+    seeds.erase(remove(seeds.begin(), seeds.end(), memberNode->addr), seeds.end());
+
+    if ( config.snapshotTime > 0 && loadSnapshot() > 0 ) {
+        // restarting with the members it knew, no introducer needed
+#ifdef DEBUGLOG
+        log->LOG(&memberNode->addr, "Restarting from snapshot...");
+#endif
+        memberNode->inGroup = true;
+    }
+
+    else if ( 0 == memcmp((char *)&(memberNode->addr.addr), (char *)&(joinaddr->addr), sizeof(memberNode->addr.addr))) {
         // I am the group booter (first process to join the group). Boot up the group
 #ifdef DEBUGLOG
         log->LOG(&memberNode->addr, "Starting up group...");
@@ -135,34 +188,44 @@ int MP1Node::introduceSelfToGroup(Address *joinaddr) {
         memberNode->inGroup = true;
         // this call will add it to introducer Membership List  
     
-        addMemberToMembershipList(*(int *)&(memberNode->addr.addr), *(short *) &(memberNode->addr.addr[4]), *(short *)&memberNode->heartbeat);           
+        addMemberToMembershipList(*(int *)&(memberNode->addr.addr), *(short *) &(memberNode->addr.addr[4]), *(short *)&memberNode->heartbeat, incarnation);           
     }
 
     else {
-        size_t msgsize = sizeof(MessageHdr) + sizeof(joinaddr->addr) + sizeof(long) + 1;  
-        msg = (MessageHdr *) malloc(msgsize * sizeof(char));
-        msg->msgType = JOINREQ;
-
-        memcpy((char *)(msg)+sizeof(MessageHdr), &memberNode->addr.addr, sizeof(Address));
-        memcpy((char *)(msg)+sizeof(MessageHdr) + sizeof(Address), &memberNode->heartbeat, sizeof(long));
- //       memcpy((char *)(msg+1), &memberNode->addr.addr, sizeof(memberNode->addr.addr));
- //       memcpy((char *)(msg+1) + 1 + sizeof(memberNode->addr.addr), &memberNode->heartbeat, sizeof(long));
+        if(seeds.empty())
+        {
+            seeds.push_back(*joinaddr);
+        }
+        joinAttempts = seeds.size() > 1 ? random.below(seeds.size()) : 0;
 
 #ifdef DEBUGLOG
         sprintf(s, "Trying to join...");
         log->LOG(&memberNode->addr, s);
 #endif
 
-        // send JOINREQ message to introducer member
-        emulNet->ENsend(&memberNode->addr, joinaddr, (char *)msg, msgsize);
-
-        free(msg);
+        sendJoinRequest();
     }
 
     return 1;
 
 }
 
+/**
+ * FUNCTION NAME: sendJoinRequest
+ *
+ * DESCRIPTION: Send a JOINREQ to the next introducer in seeds
+ */
+void MP1Node::sendJoinRequest() {
+    // JOINREQ is just the header, my address and my heartbeat
+    msgBuilder.begin(JOINREQ, &memberNode->addr, memberNode->heartbeat, incarnation, 0);
+    METRIC_ADD(bytesEncoded, msgBuilder.size());
+
+    // send JOINREQ message to introducer member
+    sendMessage(&seeds[joinAttempts % seeds.size()], msgBuilder.data(), msgBuilder.size());
+    joinAttempts++;
+    joinSentAt = par->getcurrtime();
+}
+
 /**
  * FUNCTION NAME: finishUpThisNode
  *
@@ -172,6 +235,28 @@ int MP1Node::finishUpThisNode(){
    /*
     * Your code goes here
     */
+    // no LEAVE from here: Application cleans EmulNet up before calling this, and whatever is sent
+    // then is never freed. a driver whose network still runs calls leaveGroup first
+    // a member that failed writes nothing, its last checkpoint is what it restarts from
+    if( config.snapshotTime > 0 && !memberNode->bFailed && memberNode->inGroup ) {
+        saveSnapshot();
+    }
+#ifdef MP1METRICS
+    logGossipStats();
+    logTransitionStats();
+    logMetrics();
+#endif
+
+    // nothing is kept for a restart, which joins like a new node
+    initMemberListTable(memberNode);
+    inbox.discard();
+    outbox.clear();
+    outboxMessages.clear();
+    updates.clear();
+    relays.clear();
+    probe.active = false;
+    memberNode->inGroup = false;
+    return 0;
 }
 
 /**
@@ -190,11 +275,24 @@ void MP1Node::nodeLoop() {
 
     // Wait until you're in the group...
     if( !memberNode->inGroup ) {
+        if( par->getcurrtime() - joinSentAt >= config.joinTimeout ) {
+            sendJoinRequest();          // no JOINREP, that introducer or our messages may be gone
+        }
     	return;
     }
 
     // ...then jump in and share your responsibilites!
+    METRIC_TIMER_START(opsStart);
     nodeLoopOps();
+    METRIC_TIMER_STOP(opsStart, NODELOOPOPS_HANDLER);
+    if (config.snapshotTime > 0 && par->getcurrtime() % config.snapshotTime == 0) {
+        saveSnapshot();
+    }
+#ifdef MP1METRICS
+    if (METRICSTIME > 0 && par->getcurrtime() % METRICSTIME == 0) {
+        logMetrics();
+    }
+#endif
 //    printMyMembershipList();
 
     return;
@@ -206,16 +304,22 @@ void MP1Node::nodeLoop() {
  * DESCRIPTION: Check messages in the queue and call the respective message handler
  */
 void MP1Node::checkMessages() {
-    void *ptr;
-    int size; 
-
-    // Pop waiting messages from memberNode's mp1q
-    while ( !memberNode->mp1q.empty() ) {
-    	ptr = memberNode->mp1q.front().elt;         // the message off the queue
-    	size = memberNode->mp1q.front().size;       // number of bytes of message in the queue
-    	memberNode->mp1q.pop();
-    	recvCallBack((void *)memberNode, (char *)ptr, size);
+    InboxMessage batch[INBOXBATCH];
+    int numMessages;
+    METRIC_TIMER_START(checkStart);
+
+    // Take waiting messages off the inbox a batch at a time
+    while ( (numMessages = inbox.drain(batch, INBOXBATCH)) > 0 ) {
+    	for ( int i = 0; i < numMessages; i++ ) {
+    		METRIC_TIMER_START(recvStart);
+    		if ( !recvCallBack((void *)memberNode, batch[i].data, batch[i].size) ) {
+    			METRIC_ADD(rejected, 1);
+    		}
+    		METRIC_TIMER_STOP(recvStart, RECVCALLBACK_HANDLER);
+    		free(batch[i].data);                        // EmulNet malloc'd the copy it queued for us
+    	}
     }
+    METRIC_TIMER_STOP(checkStart, CHECKMESSAGES_HANDLER);
 
     return;
 }
@@ -230,57 +334,63 @@ bool MP1Node::recvCallBack(void *env, char *data, int size ) {
 	 * Your code goes here
 	 */
     // env is memberNode that rec'd the msg
+    // every message starts with header, sender address and sender heartbeat. fields are decoded
+    // straight out of "data" through the view
 
-    MessageHdr *outgoingMsg;
-    MessageHdr *receivedMsg;
+    MessageView receivedMsg(data, size);
+    MessageHdr msgHeader;
     Address msgFromAddress;   // complete address of node that sent the message. located in "data"
     int msgFromID;            // id of node that sent the message. located in "data"
     short msgFromPort;        // port of the node that sent the message. located in "data"
     long fromHeartbeat;       // heartbeat of the node that sent the message. located in "data"
+    long fromIncarnation;     // and its incarnation
 
-    int nodeID = *(int *)(&memberNode->addr.addr);                // ID of the node that rec'd messag
-    short nodePort = *(short *)(&memberNode->addr.addr[4]);       // port of the node that rec'd message
-    long nodeHeartbeat = *(long *)(&memberNode->heartbeat);       //  heartbeat of node that rec'd a message  *** HB is accurate
-
-    size_t msgPosition = 0;    // used to iterate through the "data"
-
-    // break out info in the data
-    msgPosition += sizeof(MsgTypes);    // start after the message type
-    receivedMsg = (MessageHdr *) malloc(size * sizeof(char));      // need to allocate memory for the rec'd msg before putting data in it
-    memcpy((char*)(receivedMsg),data,size); 
-    memcpy(&msgFromID, data+sizeof(MessageHdr), sizeof(int));
-
-    memcpy(&msgFromPort, data+sizeof(MessageHdr) + sizeof(short), sizeof(short));
-    memcpy(&fromHeartbeat, data+sizeof(MessageHdr)+sizeof(Address), sizeof(long));
-    memcpy(&msgFromAddress, (char *)receivedMsg + msgPosition, sizeof(Address));
-    msgPosition += sizeof(Address);
-  //  memcpy(&fromHeartbeat, (long *)receivedMsg + msgPosition, sizeof(long));  // ******************* NOT CORRECT ****************
-
-    msgPosition += sizeof(long);
+    if(!receivedMsg.readSender(&msgHeader, &msgFromAddress, &fromHeartbeat, &fromIncarnation))
+    {
+        return false;       // not one of our messages
+    }
+    memcpy(&msgFromID, &msgFromAddress.addr[0], sizeof(int));
+    memcpy(&msgFromPort, &msgFromAddress.addr[4], sizeof(short));
+    METRIC_ADD(received[msgHeader.msgType], 1);
+    METRIC_ADD(bytesDecoded, size);
 
-   
-    int outgoingMsgSize;
+    // a LEAVE may come from the member leaving, which must not look alive for it
+    if(config.failureDetector == SWIM_DETECTOR && msgHeader.msgType != JOINREQ && msgHeader.msgType != LEAVE)
+    {
+        // any message is news from the sender, same as an ALIVE update about it
+        MembershipUpdate senderAlive = {ALIVE_UPDATE, msgFromID, msgFromPort, fromHeartbeat, fromIncarnation, 0};
+        applyUpdate(&senderAlive);
+        MemberListEntry *sender = findMember(msgFromID, msgFromPort);
+        if(sender != NULL)      // last heard from now, even if its heartbeat did not move
+        {
+            sender->timestamp = par->getcurrtime();
+        }
+    }
 
     // new node sent request to introducer node to be added to the program
     
-    switch(receivedMsg->msgType)
+    switch(msgHeader.msgType)
     {
         case(JOINREQ):      // request to introducer node from newNode to be added to group
-            addMemberToMembershipList(msgFromID, msgFromPort, fromHeartbeat);         // this call will add it to introducer Membership List
-            sendMembershipList(msgFromAddress);     // give new node the current membership list
-            
-            outgoingMsgSize = sizeof(MessageHdr)+sizeof(Address)+sizeof(long);
-            outgoingMsg = (MessageHdr *) malloc(sizeof(outgoingMsgSize));
-            outgoingMsg->msgType = JOINREP;
-            memcpy((char *)(outgoingMsg)+sizeof(MessageHdr),&memberNode->addr.addr,sizeof(Address));       //copy address of this node to the outgoing msg
-            memcpy((char *)(outgoingMsg)+sizeof(MessageHdr)+sizeof(Address), &memberNode->heartbeat, sizeof(long));  // copy heartbeat of this node to the outgoing msg
-            emulNet->ENsend(&memberNode->addr, &msgFromAddress, (char *)outgoingMsg, outgoingMsgSize);  // send JOINREP back to node letting know added
-            free(outgoingMsg);
+            if(!memberNode->inGroup)
+            {
+                break;      // a seed still joining itself, the new node will ask another
+            }
+            admitJoiner(msgFromID, msgFromPort, fromHeartbeat, fromIncarnation);        // this call will add it to introducer Membership List
+
+            buildJoinReply(&msgFromAddress);        // this node, the new node and a sample of the rest
+            sendMessage(&msgFromAddress, msgBuilder.data(), msgBuilder.size());  // send JOINREP back to node letting know added
             break;
 
         case(JOINREP):      // rec'd by the new node just added
  //           cout << "join reply rec'd by node " << nodeID << " with heartbeat " << nodeHeartbeat << endl;
             //addMemberToMembershipList(nodeID, nodePort, nodeHeartbeat);         // this call will add new node to its own Membership List
+            // on the list first, so the introducer's entry for it counts as news of itself
+            addMemberToMembershipList(*(int *)&(memberNode->addr.addr), *(short *)&(memberNode->addr.addr[4]), memberNode->heartbeat, incarnation);
+            if(!recvMembershipList(&receivedMsg, &msgFromAddress, fromHeartbeat))
+            {
+                return false;
+            }
             memberNode->inGroup = true;
 //            memberNode->heartbeat +=1;
 
@@ -290,59 +400,25 @@ bool MP1Node::recvCallBack(void *env, char *data, int size ) {
       
             break;
         case(GOSSIP):       // member rec'd an updated ML to compare to their own
-            int tempID;
-            short tempPort;
-            long tempHB;
-            bool alreadyInList;
-            int numMembers;
-            memcpy(&numMembers, data+msgPosition, sizeof(int));
-            msgPosition+=sizeof(int);
 
 //            if(nodeID == 1)
 //            {
 //            cout << "ML rec'd by " << nodeID << " from " << msgFromID << endl; 
 //            }
 
-    
-            // format id/port/heartbeat, id/port/heartbeat, ....etc
-            while (numMembers > 0)
-            {
-                numMembers--;
-                memcpy(&tempID, data+msgPosition, sizeof(int));
-                msgPosition+=sizeof(int);
-                memcpy(&tempPort, data+msgPosition, sizeof(short));
-                msgPosition+=sizeof(short);
-                memcpy(&tempHB, data+msgPosition, sizeof(long));
-                msgPosition+=sizeof(long);
-          //      cout << "checking to see if temp ID: " << tempID << " is in members " << (int)memberNode->addr.addr[0] << endl;
-                vector<MemberListEntry>::iterator thisMemberPosition;
-
-                alreadyInList = false;
-                for(thisMemberPosition = memberNode->memberList.begin();
-                    thisMemberPosition != memberNode->memberList.end();
-                    thisMemberPosition++)
-                {  
-                    if(tempID == thisMemberPosition->id)        // already have this in my list. need to check HB
-                    {
-                        if(thisMemberPosition->heartbeat < tempHB)
-                        {
-                            thisMemberPosition->heartbeat = tempHB;
-                            thisMemberPosition->timestamp = par->getcurrtime();
-                        }
-                        alreadyInList = true;
-                    } 
-                }
-                if(!alreadyInList)   // ID not found in this members list
-                {
-                    addMemberToMembershipList(tempID, tempPort, tempHB);
-                }
-            }
-            break;
+            return recvMembershipList(&receivedMsg, &msgFromAddress, fromHeartbeat);
+        case(PING):
+        case(PINGREQ):
+        case(ACK):
+            return recvProbeMessage(msgHeader.msgType, &msgFromAddress, fromHeartbeat, &receivedMsg);
+        case(LEAVE):
+            return recvLeave(&receivedMsg);
         case(DUMMYLASTMSGTYPE):
             break;
         default:
             return false;
     } 
+    return true;
 }
 
 /**
@@ -355,42 +431,24 @@ bool MP1Node::recvCallBack(void *env, char *data, int size ) {
 
 void MP1Node::nodeLoopOps() {
 
-    if (par->getcurrtime() % GOSSIPTIME != 0) {
+    purgeTombstones();
+    // members whose TFAIL, TREMOVE or TSUSPECT deadline is up are suspected or removed
+    expireMemberTimers();
+    // every member this one knew is gone, as when none in its snapshot came back. an introducer
+    // brings it back into the group. the introducer itself waits to be joined
+    if (memberNode->memberList.size() < 2 && !seeds.empty() && !(memberNode->addr == getJoinAddress())) {
+        memberNode->inGroup = false;
+        sendJoinRequest();
+        return;
+    }
+    if (config.failureDetector == SWIM_DETECTOR) {
+        probeLoopOps();
+        return;
+    }
+    if (par->getcurrtime() % (config.gossipTime * gossipStretch()) != 0) {
 	    return;
     }
-// implement memberFail
-// if enough time has gone by...declare member as failed
-// send msg fail to all other members
-
- vector<MemberListEntry>::iterator memberPosition;
-     
-    int tempPosition = 0;
-    
-    int tempID;
-    int tempTime;
-    short tempPort;
-    int nodeID = *(int *)(&memberNode->addr.addr); 
-    int numMembers = memberNode->memberList.size();
-
-    // go through each item in member list. if heartbeat has not been upated  for x number of time, declare member as suspect
-    // after Tsuspect time, if still no update, declare as failed
-    for(memberPosition = memberNode->memberList.begin();
-        memberPosition != memberNode->memberList.end();
-        memberPosition++)
-    {
-        tempID = memberPosition->id;
-        tempPort = memberPosition->port;
-        tempTime = memberPosition->timestamp;
-
-       // if after TFAIL time, if heartbeat has not increased, then declared as failed
-        if(tempTime + TREMOVE < par->getcurrtime())       // possible failure
-        {
-//            cout << "node " << tempID << " has failed at " << tempTime << " detected by " << nodeID << endl;
-            removeMemberFromMembershipList(tempID, tempPort);
-        }
 
-    }
-  
     int listPosition = getListPositionByAddress(memberNode->addr);
     if(listPosition < 0)
     {
@@ -400,6 +458,7 @@ void MP1Node::nodeLoopOps() {
     memberNode->heartbeat +=1;
     memberNode->memberList[listPosition].heartbeat = memberNode->heartbeat;
     memberNode->memberList[listPosition].timestamp = par->getcurrtime();
+    memberTable.setChanged(listPosition, par->getcurrtime());
 
     sendMembershipList();
  
@@ -420,13 +479,7 @@ int MP1Node::isNullAddress(Address *addr) {
  * DESCRIPTION: Returns the Address of the coordinator
  */
 Address MP1Node::getJoinAddress() {
-    Address joinaddr;
-
-    memset(&joinaddr, 0, sizeof(Address));
-    *(int *)(&joinaddr.addr) = 1;
-    *(short *)(&joinaddr.addr[4]) = 0;
-
-    return joinaddr;
+    return transport->getJoinAddress();
 }
 
 /**
@@ -436,6 +489,12 @@ Address MP1Node::getJoinAddress() {
  */
 void MP1Node::initMemberListTable(Member *memberNode) {
 	memberNode->memberList.clear();
+	memberTable.attach(&memberNode->memberList);
+	tombstoneList.clear();
+	tombstones.attach(&tombstoneList);
+	ring.reset(config.ringVirtualNodes);
+	memberTimers.reset(par->getcurrtime());
+	tombstoneTimers.reset(par->getcurrtime());
 }
 
 /**
@@ -453,43 +512,65 @@ void MP1Node::printAddress(Address *addr)
 // ********  MY ADDED FUNCTION ************ //
 
 
-void MP1Node::addMemberToMembershipList(int id, short port, long heatbeat)
+void MP1Node::addMemberToMembershipList(int id, short port, long heatbeat, long memberIncarnation)
 {
-    MemberListEntry *newEntry = new MemberListEntry(id, port, heatbeat, (long)par->getcurrtime());
-    memberNode->memberList.emplace_back(*newEntry);
+    bool added;
+    MemberListEntry *entry = memberTable.insert(id, port, heatbeat, (long)par->getcurrtime(), &added);
+    if(!added)      // already on the list, nothing to log
+    {
+        return;
+    }
+    memberTable.stateOf(entry).incarnation = memberIncarnation;
+    ring.add(id, port);
+    armMemberTimer(entry);
+    METRIC_ADD(entriesAdded, 1);
 
     #ifdef DEBUGLOG
         Address newNodeAddress;
         memcpy(&newNodeAddress.addr, &id,sizeof(int));
         memcpy(&newNodeAddress.addr[4], &port, sizeof(short));
+#ifdef MP1BINARYLOG
+        logRecord(NODE_ADDED_RECORD, &newNodeAddress);
+#else
+        std::lock_guard<std::mutex> guard(logLock);
         log->logNodeAdd(&memberNode->addr, &newNodeAddress);
+#endif
     #endif
 }
 
 
 void MP1Node::removeMemberFromMembershipList(int id, short port)
 {
-    vector<MemberListEntry>::iterator memberPosition;
-    for(memberPosition = memberNode->memberList.begin();
-        memberPosition != memberNode->memberList.end();
-        memberPosition++)
-        {
-            if((id == memberPosition->id) && (port == memberPosition->port))
-            {
-                memberNode->memberList.erase(memberPosition);
-                break;
-            }
-        }
+    MemberListEntry *entry = findMember(id, port);
+    if(entry == NULL)     // not on the list, nothing to log
+    {
+        return;
+    }
+    memberTimers.cancel(memberTable.stateOf(entry).timer);
+    memberTable.remove(id, port);
+    ring.remove(id, port);
+    METRIC_ADD(entriesRemoved, 1);
 
     #ifdef DEBUGLOG
         Address eraseNodeAddress;
         memcpy(&eraseNodeAddress.addr, &id,sizeof(int));
         memcpy(&eraseNodeAddress.addr[4], &port, sizeof(short));
+#ifdef MP1BINARYLOG
+        logRecord(NODE_REMOVED_RECORD, &eraseNodeAddress);
+#else
+        std::lock_guard<std::mutex> guard(logLock);
         log->logNodeRemove(&memberNode->addr, &eraseNodeAddress);
+#endif
     #endif
     //memberNode->memberList.erase(memberNode->myPos);
 }
 
+// returns this member's entry for id/port, NULL if not on the list
+MemberListEntry *MP1Node::findMember(int id, short port)
+{
+    return memberTable.find(id, port);
+}
+
 void MP1Node::printMyMembershipList()
 {
     vector<MemberListEntry>::iterator memberPosition;
@@ -529,154 +610,2696 @@ void MP1Node::processJoinResponseRequest()
 // used by the introducer node to send current membership list to recently added node
 void MP1Node::sendMembershipList(Address sendToMember)
 {
-    int tempID;
-    short tempPort;
-    long tempHB; 
-    int nodeID = *(int *)(&memberNode->addr.addr);  
-    int numMembers = memberNode->memberList.size();     // will be added to message to let receiver know how many members their are
-    int msgPosition = 0;
-    MessageHdr *membershipListMsg;
-    size_t listMsgSize = sizeof sizeof(MessageHdr) + sizeof(Address) + sizeof(long) + sizeof(int) +
-        (numMembers)*(sizeof(int)+sizeof(short)+sizeof(long));
-
-    membershipListMsg = (MessageHdr *) malloc(listMsgSize);
-    membershipListMsg->msgType = GOSSIP;
-    msgPosition += sizeof(MsgTypes);    // move pointer to next position in the message
-    memcpy((char *)(membershipListMsg)+msgPosition,&memberNode->addr.addr,sizeof(Address));
-    msgPosition += sizeof(Address);
-    memcpy((char *)(membershipListMsg) + msgPosition, &memberNode->heartbeat, sizeof(long));
-    msgPosition += sizeof(long);
-    memcpy((char *)(membershipListMsg) + msgPosition, &numMembers, sizeof(int));        // pass number of members in the list
-    msgPosition += sizeof(int);
-    
-    vector<MemberListEntry>::iterator memberPosition;
-     
-     // go through this members list and add each entry to the message
-    int tempPosition = 0;
-    for(memberPosition = memberNode->memberList.begin();
-        memberPosition != memberNode->memberList.end();
-        memberPosition++)
-    {  
+    buildMembershipList(-1, GOSSIP);
+    sendMessage(&sendToMember, msgBuilder.data(), msgBuilder.size());
+}
+
+
+
+// builds a msgType message in msgBuilder holding the live members whose entry changed after the given round
+// pass -1 to get every live member. returns how many members were put in the message
+// don't sender a member on list that has failed (has not yet been removed)
+int MP1Node::buildMembershipList(long changedAfter, MsgTypes msgType)
+{
+    size_t numMembers = memberNode->memberList.size();
 
-        memcpy((char *)(membershipListMsg)+msgPosition, &memberPosition->id, sizeof(int));
-        msgPosition += sizeof(int);
-        memcpy((char *)(membershipListMsg)+msgPosition, &memberPosition->port, sizeof(short));
-        msgPosition += sizeof(short);
-        memcpy((char *)(membershipListMsg)+msgPosition, &memberPosition->heartbeat, sizeof(long));
-        msgPosition += sizeof(long);
+    // one scan over the status and changed columns finds the entries to send, failed members are left out
+    int numReportable = memberTable.markReportable(changedAfter, &reportable);
+
+    // sorted ids differ by small steps, which is what keeps the deltas to a byte. a few changed
+    // entries are cheaper to sort than walking every member in id order
+    batchPositions.clear();
+    if((size_t)numReportable * SORTSHARE < numMembers)
+    {
+        for(size_t word = 0; word < reportable.size(); word++)
+        {
+            for(unsigned long long bits = reportable[word]; bits != 0; bits &= bits - 1)
+            {
+                batchPositions.push_back(word * 64 + __builtin_ctzll(bits));
+            }
+        }
+        batchMembers(batchPositions);
+    }
+    else
+    {
+        const vector<int> &order = memberTable.positionsByID();
+        entryBatch.clear();
+        entryIncarnations.clear();
+        for(size_t i = 0; i < order.size(); i++)
+        {
+            if(reportable[order[i] / 64] >> (order[i] % 64) & 1)
+            {
+                entryBatch.push_back(memberNode->memberList[order[i]]);
+                entryIncarnations.push_back(memberTable.stateAt(order[i]).incarnation);
+            }
+        }
     }
-    emulNet->ENsend(&memberNode->addr, &sendToMember, (char *)membershipListMsg, listMsgSize);
-    free(membershipListMsg);
+    return encodeEntryBatch(msgType);
 }
 
+// builds the JOINREP for joiner in msgBuilder. a list of up to joinSample members goes whole, a longer
+// one as this node, the joiner and a random sample of the others, so one introducer's replies to a
+// mass join stay bounded and the joiner learns the rest through gossip. returns the entries sent
+int MP1Node::buildJoinReply(Address *joiner)
+{
+    int joinerID;
+    short joinerPort;
 
+    if(config.joinSample <= 0 || (int)memberNode->memberList.size() <= config.joinSample)
+    {
+        return buildMembershipList(-1, JOINREP);
+    }
 
-// send member list to defined number of random nodes
-// don't sender a member on list that has failed (has not yet been removed)
-void MP1Node::sendMembershipList()
+    memcpy(&joinerID, &joiner->addr[0], sizeof(int));
+    memcpy(&joinerPort, &joiner->addr[4], sizeof(short));
+    int selfPosition = getListPositionByAddress(memberNode->addr);
+    int joinerPosition = memberTable.position(joinerID, joinerPort);
+    int numSampled = sampleMembers(max(config.joinSample - 2, 0), joiner);
+
+    batchPositions.clear();
+    if(selfPosition >= 0)
+    {
+        batchPositions.push_back(selfPosition);
+    }
+    if(joinerPosition >= 0)     // the joiner finds itself on the list like every member does
+    {
+        batchPositions.push_back(joinerPosition);
+    }
+    for(int i = 0; i < numSampled; i++)
+    {
+        if(isReportable(samplePositions[i]))
+        {
+            batchPositions.push_back(samplePositions[i]);
+        }
+    }
+    batchMembers(batchPositions);
+    return encodeEntryBatch(JOINREP);
+}
+
+// fills entryBatch and entryIncarnations with the members at positions, sorting positions by id
+void MP1Node::batchMembers(vector<int> &positions)
 {
+    vector<MemberListEntry> &list = memberNode->memberList;
 
-       vector<MemberListEntry>::iterator liveCheckPosition;
-     
-     // go through this members list and add each entry to the message
-    int numAlive = 0;
-    for(liveCheckPosition = memberNode->memberList.begin();
-        liveCheckPosition != memberNode->memberList.end();
-        liveCheckPosition++)
-    {   
-        if(liveCheckPosition->gettimestamp()+TFAIL >= par->getcurrtime())      // if not true, then member has failed
+    sort(positions.begin(), positions.end(), [&list](int first, int second) { return entryIDBefore(list[first], list[second]); });
+    entryBatch.clear();
+    entryIncarnations.clear();
+    for(size_t i = 0; i < positions.size(); i++)
+    {
+        entryBatch.push_back(list[positions[i]]);
+        entryIncarnations.push_back(memberTable.stateAt(positions[i]).incarnation);
+    }
+}
+
+// writes a msgType message in msgBuilder holding entryBatch, which must be sorted by id.
+// returns how many members were put in the message
+int MP1Node::encodeEntryBatch(MsgTypes msgType)
+{
+    unsigned int prevID = 0;
+
+    msgBuilder.begin(msgType, &memberNode->addr, memberNode->heartbeat, incarnation,
+                     MAXVARINTSIZE + entryBatch.size() * MAXENTRYSIZE);
+    msgBuilder.writeVarint(entryBatch.size());        // pass number of members in the list
+    for(size_t i = 0; i < entryBatch.size(); i++)
+    {
+        msgBuilder.writeVarint((unsigned int)entryBatch[i].id - prevID);
+        msgBuilder.writeVarint((unsigned short)entryBatch[i].port);
+        msgBuilder.writeVersion(entryBatch[i].heartbeat - memberNode->heartbeat, entryIncarnations[i]);
+        prevID = (unsigned int)entryBatch[i].id;
+    }
+    METRIC_ADD(bytesEncoded, msgBuilder.size());
+
+    return (int)entryBatch.size();
+}
+
+// decodes the entry count and entries of a GOSSIP or JOINREP and merges them into this member's list.
+// false if the message is cut short, then nothing changes
+bool MP1Node::recvMembershipList(MessageView *receivedMsg, Address *fromAddress, long fromHeartbeat)
+{
+    unsigned long long numMembers;
+
+    if(!receivedMsg->readVarint(&numMembers) || numMembers > receivedMsg->remaining() / MINENTRYSIZE)
+    {
+        return false;       // member count does not fit in the message
+    }
+    // format id delta/port/heartbeat delta, ....etc
+    // decode the whole list first so a truncated message changes nothing
+    if(!decodeMembershipList(receivedMsg, numMembers, fromHeartbeat))
+    {
+        return false;
+    }
+    METRIC_ADD(entriesDecoded, entryBatch.size());
+    mergeMembershipList(fromAddress);
+    return true;
+}
+
+// reverses buildMembershipList into entryBatch. false if the entries run past the end of the message
+bool MP1Node::decodeMembershipList(MessageView *receivedMsg, unsigned long long numMembers, long fromHeartbeat)
+{
+    unsigned int entryID = 0;
+    unsigned long long idDelta;
+    unsigned long long entryPort;
+    long heartbeatDelta;
+    long entryIncarnation;
+
+    entryBatch.clear();
+    entryIncarnations.clear();
+    for(unsigned long long i = 0; i < numMembers; i++)
+    {
+        if(!receivedMsg->readVarint(&idDelta) || idDelta > 0xFFFFFFFFULL ||
+           !receivedMsg->readVarint(&entryPort) || entryPort > 0xFFFF ||
+           !receivedMsg->readVersion(&heartbeatDelta, &entryIncarnation))
+        {
+            return false;
+        }
+        entryID += (unsigned int)idDelta;
+        entryBatch.push_back(MemberListEntry((int)entryID, (short)entryPort, fromHeartbeat + heartbeatDelta, 0));
+        entryIncarnations.push_back(entryIncarnation);
+    }
+    return true;
+}
+
+// merges the decoded entryBatch into this member's list. every entry is looked up in one batch,
+// one pass over the versions finds the newer ones, and the table grows once for all new members.
+// the changes are then made in message order, the same order merging one entry at a time would.
+// a member that stays alive keeps its timer: a newer heartbeat only moves its deadline later, and
+// memberTimerExpired re-arms it at the real one when the old one comes up. a sender still listing
+// a member that left is told so, and newer news of this node is refuted
+void MP1Node::mergeMembershipList(Address *fromAddress)
+{
+    size_t numEntries = entryBatch.size();
+    size_t numNew = 0;
+    int myPosition = getListPositionByAddress(memberNode->addr);
+
+    memberTable.findBatch(entryBatch, &mergePositions);
+    mergeHeartbeats.resize(numEntries);
+    localHeartbeats.resize(numEntries);
+    mergeIncarnations.resize(numEntries);
+    localIncarnations.resize(numEntries);
+    mergeNewer.resize(numEntries);
+    for(size_t i = 0; i < numEntries; i++)
+    {
+        int position = mergePositions[i];
+        mergeHeartbeats[i] = entryBatch[i].heartbeat;
+        mergeIncarnations[i] = entryIncarnations[i];
+        localHeartbeats[i] = position < 0 ? LONG_MAX : memberNode->memberList[position].heartbeat;
+        localIncarnations[i] = position < 0 ? LONG_MAX : memberTable.stateAt(position).incarnation;
+        numNew += position < 0;
+    }
+    // branch free over contiguous arrays so the compiler can vectorize it
+    for(size_t i = 0; i < numEntries; i++)
+    {
+        mergeNewer[i] = (mergeIncarnations[i] > localIncarnations[i]) |
+                        ((mergeIncarnations[i] == localIncarnations[i]) & (mergeHeartbeats[i] > localHeartbeats[i]));
+    }
+    if(numNew > 0)
+    {
+        memberTable.reserve(memberTable.size() + numNew);     // list entries stay put while we add
+    }
+
+    for(size_t i = 0; i < numEntries; i++)
+    {
+        MemberListEntry *thisMember;
+        if(mergePositions[i] >= 0)
         {
-            numAlive++;
+            if(!mergeNewer[i])
+            {
+                continue;
+            }
+            if(mergePositions[i] == myPosition)
+            {
+                refuteNews(ALIVE_UPDATE, mergeIncarnations[i], mergeHeartbeats[i]);
+                continue;
+            }
+            thisMember = &memberNode->memberList[mergePositions[i]];
+        }
+        else
+        {
+            // new to us, unless the message listed it twice and the first copy just added it
+            thisMember = findMember(entryBatch[i].id, entryBatch[i].port);
+            if(thisMember == NULL)
+            {
+                if(!admitMember(entryBatch[i].id, entryBatch[i].port, mergeHeartbeats[i], mergeIncarnations[i]))
+                {
+                    answerLeftMember(entryBatch[i].id, entryBatch[i].port, fromAddress);
+                }
+                continue;
+            }
+            if(!isNewer(mergeIncarnations[i], mergeHeartbeats[i], incarnationOf(thisMember), thisMember->heartbeat))
+            {
+                continue;
+            }
         }
+        int position = memberTable.positionOf(thisMember);
+        METRIC_ADD(entriesMerged, 1);
+        setVersion(thisMember, mergeHeartbeats[i], mergeIncarnations[i]);
+        if(memberTable.statusAt(position) != MEMBER_ALIVE)
+        {
+            setMemberStatus(thisMember, MEMBER_ALIVE);      // a suspect that was only slow
+            armMemberTimer(thisMember);
+        }
+    }
+}
 
+// members worth telling others about: suspects are left out, whichever detector suspected them
+bool MP1Node::isReportable(int position)
+{
+    return memberTable.statusAt(position) == MEMBER_ALIVE;
+}
+
+// orders entries the way buildMembershipList sends them: by id, then by port
+bool MP1Node::entryIDBefore(const MemberListEntry &first, const MemberListEntry &second)
+{
+    if(first.id != second.id)
+    {
+        return (unsigned int)first.id < (unsigned int)second.id;
     }
- //  cout << "number alive " << numAlive << " for member ID " << *(int *)(&memberNode->addr.addr) << endl;
-  //  cout << "size of ML " << memberNode->memberList.size() << endl <<endl;
+    return (unsigned short)first.port < (unsigned short)second.port;
+}
+
+// send member list to defined number of random nodes
+// in DELTA_GOSSIP mode each node only gets the entries that changed since we last gossiped to it,
+// except every antiEntropyTime rounds when everyone gets the full list
+void MP1Node::sendMembershipList()
+{
     // only one item on list. do not send
     if(memberNode->memberList.size() < 2)
     {
         return;
     }
-    
-    int msgPosition = 0;
-    MessageHdr *membershipListMsg;
-    size_t listMsgSize = sizeof sizeof(MessageHdr) + sizeof(Address) + sizeof(long) + sizeof(int) +
-        (numAlive)*(sizeof(int)+sizeof(short)+sizeof(long));
-
-    membershipListMsg = (MessageHdr *) malloc(listMsgSize);
-    membershipListMsg->msgType = GOSSIP;
-    msgPosition += sizeof(MsgTypes);    // move pointer to next position in the message
-    memcpy((char *)(membershipListMsg)+msgPosition,&memberNode->addr.addr,sizeof(Address));
-    msgPosition += sizeof(Address);
-    memcpy((char *)(membershipListMsg) + msgPosition, &memberNode->heartbeat, sizeof(long));
-    msgPosition += sizeof(long);
-    memcpy((char *)(membershipListMsg) + msgPosition, &numAlive, sizeof(int));        // pass number of members in the list
-    msgPosition += sizeof(int);
 
-    vector<MemberListEntry>::iterator memberPosition;
-     
-     // go through this members list and add each entry to the message
-    int tempPosition = 0;
-    for(memberPosition = memberNode->memberList.begin();
-        memberPosition != memberNode->memberList.end();
-        memberPosition++)
+    long currTime = par->getcurrtime();
+    GossipStats *stats = &gossipStats[config.gossipMode];
+    bool fullRound = (config.gossipMode == FULL_GOSSIP) || (stats->rounds % config.antiEntropyTime == 0);
+    Address *sendTo;
+    int numTargets = 0;
+    int numSampled;
+
+    stats->rounds++;
+    stats->lastRoundBytes = 0;
+
+    // fan-out distinct members other than this node, alive ones first
+    numSampled = sampleMembers(gossipFanout(), NULL);
+    gossipTargets.resize(numSampled);
+    sendTo = gossipTargets.data();
+    for(int i = 0; i < numSampled; i++)
+    {   
+        int sendToPosition = samplePositions[i];
+        MemberState &sendToState = memberTable.stateAt(sendToPosition);
+        memcpy(&sendTo[numTargets].addr[0], &memberNode->memberList[sendToPosition].id, sizeof(int));
+        memcpy(&sendTo[numTargets].addr[4], &memberNode->memberList[sendToPosition].port, sizeof(short));
 
-    {  
-        if(memberPosition->timestamp + TFAIL < par->getcurrtime())
+        if(fullRound)       // sent to every target at once below
         {
-         //   cout << "possible fail at " << memberPosition->id << endl;
-            continue;
+            numTargets++;
+        }
+        else if(buildMembershipList(sendToState.lastSent, GOSSIP) > 0)
+        {
+            // dropped before the next target's list is built, so that one reuses the arena
+            SharedPayload payload = msgBuilder.share();
+            sendPayload(payload, &sendTo[numTargets], 1);
+            stats->messages++;
+            stats->bytes += payload.size();
+            stats->lastRoundBytes += payload.size();
         }
-    //    cout << "memberPosition " << memberPosition->getid() << endl;
-        memcpy((char *)(membershipListMsg)+msgPosition, &memberPosition->id, sizeof(int));
-        msgPosition += sizeof(int);
-        memcpy((char *)(membershipListMsg)+msgPosition, &memberPosition->port, sizeof(short));
-        msgPosition += sizeof(short);
-        memcpy((char *)(membershipListMsg)+msgPosition, &memberPosition->heartbeat, sizeof(long));
-        msgPosition += sizeof(long);
+        sendToState.lastSent = currTime;
     }
 
-   // srand(time(NULL));
-    for(int i = 0; i<NUMTOGOSSIP; i++)
-    {   
-        Address sendTo;
-
-        //int sendToID = rand() % (numMembers-1) + 1; // randomly pick with member ID to sent to
-        int sendToID = rand() % (memberNode->memberList.size()) + 1;
-  //      cout << "Random node select is " << sendToID << " selected by " << nodeID << endl;
-        memcpy(&sendTo.addr[0], &memberNode->memberList[sendToID-1].id, sizeof(int));
-        memcpy(&sendTo.addr[4], &memberNode->memberList[sendToID-1].port, sizeof(short));
-        emulNet->ENsend(&memberNode->addr, &sendTo, (char *)membershipListMsg, listMsgSize);
-      
-     
+    if(fullRound)       // every target gets the same message, build it once
+    {
+        if(buildMembershipList(-1, GOSSIP) > 0)
+        {
+            SharedPayload payload = msgBuilder.share();
+            sendPayload(payload, sendTo, numTargets);
+            stats->messages += numTargets;
+            stats->bytes += numTargets * payload.size();
+            stats->lastRoundBytes += numTargets * payload.size();
+        }
     }
-    free(membershipListMsg);
 }
 
-// takes memberID and returns where in that member's membership list they are located
-int MP1Node::getListPositionByAddress(Address memberAddr)
+// hands one encoded message to the network for each target. every target shares the same
+// payload, nothing is re-encoded or copied on our side. returns how many sends the network took
+int MP1Node::sendPayload(SharedPayload &payload, Address *sendTo, int numTargets)
 {
-    int listLocation = 0;
-    int thisID = (int)memberAddr.addr[0];
-    short thisPort = (short)memberAddr.addr[4];
-    int tempID;
-    short tempPort;
- //   cout << "looking up ID " << thisID << " in ML " << endl;
-    vector<MemberListEntry>::iterator memberPosition;
-    for(memberPosition = memberNode->memberList.begin();
-        memberPosition != memberNode->memberList.end();
-        memberPosition++)
+    return sendMessages(sendTo, numTargets, (char *)payload.data(), payload.size());
+}
+
+int MP1Node::sendMessage(Address *sendTo, char *data, int size)
+{
+    return sendMessages(sendTo, 1, data, size) > 0 ? size : 0;
+}
+
+// every message leaves through here so traffic counts all of them, dropped ones included.
+// the targets go to the transport in one call. while sends are buffered the message is copied
+// to the outbox once and assumed sent. returns how many targets the message went to
+int MP1Node::sendMessages(Address *sendTo, int numTargets, char *data, int size)
+{
+    traffic.messages += numTargets;
+    traffic.bytes += (long)numTargets * size;
+    if(bufferSends)
+    {
+        OutboxMessage message;
+        message.offset = outbox.size();
+        message.size = size;
+        outbox.insert(outbox.end(), data, data + size);
+        for(int i = 0; i < numTargets; i++)
+        {
+            message.to = sendTo[i];
+            outboxMessages.push_back(message);
+        }
+        return numTargets;
+    }
+    return transport->sendMany(&memberNode->addr, sendTo, numTargets, data, size);
+}
+
+// with buffering on, a driver can run many nodes' loops at once and still hand the transport, which
+// need not be thread safe, every message from one thread in the order a sequential run would have
+void MP1Node::setBufferSends(bool bufferSends)
+{
+    if(!bufferSends)
+    {
+        flushSends();
+    }
+    this->bufferSends = bufferSends;
+}
+
+// sends everything in the outbox in the order it was queued. returns how many the network took
+int MP1Node::flushSends()
+{
+    int numSent = 0;
+    vector<Address> targets;
+    size_t first = 0;
+    while(first < outboxMessages.size())
     {
-        tempID = memberPosition->id;
-        tempPort = memberPosition->port;
-//        cout << "look up member. this ID: " << thisID << " list position id: " << tempID << " list location: " << listLocation << endl;
-        if((tempID == thisID) && (tempPort == thisPort))
+        OutboxMessage *message = &outboxMessages[first];
+        size_t last = first;
+        targets.clear();
+        while(last < outboxMessages.size() && outboxMessages[last].offset == message->offset)
+        {
+            targets.push_back(outboxMessages[last++].to);
+        }
+        numSent += transport->sendMany(&memberNode->addr, &targets[0], targets.size(), &outbox[message->offset], message->size);
+        first = last;
+    }
+    outbox.clear();
+    outboxMessages.clear();
+    return numSent;
+}
+
+TrafficStats MP1Node::getTrafficStats()
+{
+    return traffic;
+}
+
+// messages lost because the inbox was full when they arrived
+long MP1Node::getInboxDrops()
+{
+    return inbox.getDropped();
+}
+
+// FULL_GOSSIP or DELTA_GOSSIP for the periodic gossip. the join reply does not change, it carries a sample of
+// joinSample members once the list is longer, see buildJoinReply
+void MP1Node::setGossipMode(GossipMode mode)
+{
+    config.gossipMode = mode;
+}
+
+// HEARTBEAT_DETECTOR or SWIM_DETECTOR. pick before the node starts
+void MP1Node::setFailureDetector(FailureDetector detector)
+{
+    config.failureDetector = detector;
+    for(size_t i = 0; i < memberNode->memberList.size(); i++)     // the detectors keep different deadlines
+    {
+        armMemberTimer(&memberNode->memberList[i]);
+    }
+}
+
+GossipStats MP1Node::getGossipStats(GossipMode mode)
+{
+    return gossipStats[mode];
+}
+
+// write bytes sent per gossip round for each mode that was used
+void MP1Node::logGossipStats()
+{
+#ifdef DEBUGLOG
+    static const char *modeNames[NUMGOSSIPMODES] = {"full", "delta"};
+    for(int mode = 0; mode < NUMGOSSIPMODES; mode++)
+    {
+        GossipStats *stats = &gossipStats[mode];
+        if(stats->rounds == 0)
+        {
+            continue;
+        }
+        log->LOG(&memberNode->addr, "%s gossip: %ld rounds, %ld messages, %ld bytes, %ld bytes per round",
+                 modeNames[mode], stats->rounds, stats->messages, stats->bytes, stats->bytes / stats->rounds);
+    }
+#endif
+}
+
+// takes memberID and returns where in that member's membership list they are located
+int MP1Node::getListPositionByAddress(Address memberAddr)
+{
+    int thisID;
+    short thisPort;
+    memcpy(&thisID, &memberAddr.addr[0], sizeof(int));
+    memcpy(&thisPort, &memberAddr.addr[4], sizeof(short));
+ //   cout << "looking up ID " << thisID << " in ML " << endl;
+    return memberTable.position(thisID, thisPort);     // -1 if no member found
+}
+
+// ********  SWIM FAILURE DETECTOR ************ //
+
+// one SWIM protocol period: settle the last probe, then ping one random member.
+// a target that does not ack within PINGTIMEOUT is pinged through NUMPINGREQ other members,
+// one that never acks by the end of the period becomes a suspect and is removed after TSUSPECT
+void MP1Node::probeLoopOps()
+{
+    long currTime = par->getcurrtime();
+    int targetID;
+    short targetPort;
+
+    if(probe.active && probe.sentAt + config.probeTime <= currTime)      // no ack, directly or through the PINGREQs
+    {
+        memcpy(&targetID, &probe.target.addr[0], sizeof(int));
+        memcpy(&targetPort, &probe.target.addr[4], sizeof(short));
+        MemberListEntry *target = findMember(targetID, targetPort);
+        if(target != NULL)
+        {
+            suspectMember(target);
+        }
+        probe.active = false;
+    }
+    else if(probe.active && !probe.indirect && probe.sentAt + config.pingTimeout <= currTime)
+    {
+        int numHelpers = sampleMembers(config.numPingReq, &probe.target);
+        for(int i = 0; i < numHelpers; i++)
+        {
+            int helperPosition = samplePositions[i];
+            Address helper;
+            memcpy(&helper.addr[0], &memberNode->memberList[helperPosition].id, sizeof(int));
+            memcpy(&helper.addr[4], &memberNode->memberList[helperPosition].port, sizeof(short));
+            sendProbeMessage(PINGREQ, &helper, probe.seq, &probe.target);
+        }
+        probe.indirect = true;
+    }
+
+    // relays whose target never answered are given up on
+    for(size_t i = 0; i < relays.size(); )
+    {
+        if(relays[i].sentAt + config.probeTime <= currTime)
+        {
+            relays[i] = relays.back();
+            relays.pop_back();
+            continue;
+        }
+        i++;
+    }
+
+    if(!probe.active)
+    {
+        if(sampleMembers(1, NULL) == 0)
+        {
+            return;
+        }
+        int targetPosition = samplePositions[0];
+        memcpy(&probe.target.addr[0], &memberNode->memberList[targetPosition].id, sizeof(int));
+        memcpy(&probe.target.addr[4], &memberNode->memberList[targetPosition].port, sizeof(short));
+        probe.seq = ++probeSeq;
+        probe.sentAt = currTime;
+        probe.indirect = false;
+        probe.active = true;
+        sendProbeMessage(PING, &probe.target, probe.seq, NULL);
+    }
+}
+
+// picks up to count distinct members other than this node and exclude into samplePositions and returns
+// how many it found. alive members come first, suspects only make up for too few alive ones.
+// partial Fisher-Yates over sampleOrder: each pick swaps a random remaining position forward, so a
+// sample costs about count steps while most members are alive
+int MP1Node::sampleMembers(int count, Address *exclude)
+{
+    unsigned int numMembers = memberNode->memberList.size();
+    int numPicked = 0;
+
+    samplePositions.clear();
+    sampleFallback.clear();
+    if(sampleOrder.size() != numMembers)      // membership changed, any order is a fine start
+    {
+        sampleOrder.resize(numMembers);
+        for(unsigned int i = 0; i < numMembers; i++)
+        {
+            sampleOrder[i] = i;
+        }
+    }
+
+    for(unsigned int i = 0; i < numMembers && numPicked < count; i++)
+    {
+        swap(sampleOrder[i], sampleOrder[i + random.below(numMembers - i)]);
+        int position = sampleOrder[i];
+        Address candidate;
+        memcpy(&candidate.addr[0], &memberNode->memberList[position].id, sizeof(int));
+        memcpy(&candidate.addr[4], &memberNode->memberList[position].port, sizeof(short));
+        if(candidate == memberNode->addr || (exclude != NULL && candidate == *exclude))
+        {
+            continue;
+        }
+        if(memberTable.statusAt(position) != MEMBER_ALIVE)
+        {
+            if((int)sampleFallback.size() < count)
+            {
+                sampleFallback.push_back(position);
+            }
+            continue;
+        }
+        samplePositions.push_back(position);
+        numPicked++;
+    }
+    for(size_t i = 0; i < sampleFallback.size() && numPicked < count; i++)
+    {
+        samplePositions.push_back(sampleFallback[i]);
+        numPicked++;
+    }
+    return numPicked;
+}
+
+// replaces the per node seed, e.g. to replay a run
+void MP1Node::seedRandom(unsigned long long seed)
+{
+    random.seed(seed);
+}
+
+// how many members each gossip round goes to, at least
+void MP1Node::setFanout(int fanout)
+{
+    config.numToGossip = max(fanout, 1);
+}
+
+// the compiled in settings
+MP1Config MP1Node::defaultConfig()
+{
+    MP1Config config;
+    config.tRemove = TREMOVE;
+    config.tFail = TFAIL;
+    config.tTombstone = TTOMBSTONE;
+    config.numToGossip = NUMTOGOSSIP;
+    config.gossipTime = GOSSIPTIME;
+    config.gossipMode = GOSSIPMODE;
+    config.antiEntropyTime = ANTIENTROPYTIME;
+    config.failureDetector = FAILUREDETECTOR;
+    config.probeTime = PROBETIME;
+    config.pingTimeout = PINGTIMEOUT;
+    config.numPingReq = NUMPINGREQ;
+    config.tSuspect = TSUSPECT;
+    config.maxPiggyback = MAXPIGGYBACK;
+    config.retransmitMult = RETRANSMITMULT;
+    config.fanoutLogScale = FANOUTLOGSCALE;
+    config.gossipStretch = GOSSIPSTRETCH;
+    config.joinSeeds = JOINSEEDS;
+    config.joinTimeout = JOINTIMEOUT;
+    config.joinSample = JOINSAMPLE;
+    config.snapshotTime = SNAPSHOTTIME;
+    config.ringVirtualNodes = RINGVNODES;
+    return config;
+}
+
+// overrides config with the KEY: value lines of the file. returns false if it cannot be opened
+bool MP1Node::loadConfig(const char *path, MP1Config *config)
+{
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    char key[64];
+    char value[64];
+
+    if(fp == NULL)
+    {
+        return false;
+    }
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        if(sscanf(line, " %63[^: \t] : %63s", key, value) != 2)
+        {
+            continue;
+        }
+        string name(key);
+        long number = strtol(value, NULL, 10);
+
+        if(name == "TREMOVE") config->tRemove = number;
+        else if(name == "TFAIL") config->tFail = number;
+        else if(name == "TTOMBSTONE") config->tTombstone = number;
+        else if(name == "NUMTOGOSSIP") config->numToGossip = (int)number;
+        else if(name == "GOSSIPTIME") config->gossipTime = number;
+        else if(name == "GOSSIPMODE") config->gossipMode = (strcmp(value, "DELTA_GOSSIP") == 0 || number == DELTA_GOSSIP) ? DELTA_GOSSIP : FULL_GOSSIP;
+        else if(name == "ANTIENTROPYTIME") config->antiEntropyTime = number;
+        else if(name == "FAILUREDETECTOR") config->failureDetector = (strcmp(value, "SWIM_DETECTOR") == 0 || number == SWIM_DETECTOR) ? SWIM_DETECTOR : HEARTBEAT_DETECTOR;
+        else if(name == "PROBETIME") config->probeTime = number;
+        else if(name == "PINGTIMEOUT") config->pingTimeout = number;
+        else if(name == "NUMPINGREQ") config->numPingReq = (int)number;
+        else if(name == "TSUSPECT") config->tSuspect = number;
+        else if(name == "MAXPIGGYBACK") config->maxPiggyback = (int)number;
+        else if(name == "RETRANSMITMULT") config->retransmitMult = (int)number;
+        else if(name == "FANOUTLOGSCALE") config->fanoutLogScale = strtod(value, NULL);
+        else if(name == "GOSSIPSTRETCH") config->gossipStretch = (int)number;
+        else if(name == "JOINSEEDS") config->joinSeeds = (int)number;
+        else if(name == "JOINTIMEOUT") config->joinTimeout = number;
+        else if(name == "JOINSAMPLE") config->joinSample = (int)number;
+        else if(name == "SNAPSHOTTIME") config->snapshotTime = number;
+        else if(name == "RINGVNODES") config->ringVirtualNodes = (int)number;
+    }
+    fclose(fp);
+
+    // periods are divided by, counts are looped over
+    config->gossipTime = max(config->gossipTime, 1L);
+    config->antiEntropyTime = max(config->antiEntropyTime, 1L);
+    config->probeTime = max(config->probeTime, 1L);
+    config->numToGossip = max(config->numToGossip, 1);
+    config->joinSeeds = max(config->joinSeeds, 1);
+    config->joinTimeout = max(config->joinTimeout, 1L);
+    return true;
+}
+
+// the defaults, overridden from the MP1CONFIGENV file the first time a node asks
+const MP1Config &MP1Node::sharedConfig()
+{
+    static MP1Config config = defaultConfig();
+    static bool loaded = false;
+
+    if(!loaded)
+    {
+        const char *path = getenv(MP1CONFIGENV);
+        if(path != NULL && !loadConfig(path, &config))
+        {
+            cout << "could not read config " << path << ", using defaults" << endl;
+        }
+        loaded = true;
+    }
+    return config;
+}
+
+// replaces every setting of this node, e.g. for one point of a parameter sweep
+void MP1Node::setConfig(const MP1Config &config)
+{
+    if(config.ringVirtualNodes != this->config.ringVirtualNodes)     // every point moves, so the ring is rebuilt
+    {
+        ring.reset(config.ringVirtualNodes);
+        for(size_t i = 0; i < memberNode->memberList.size(); i++)
+        {
+            ring.add(memberNode->memberList[i].id, memberNode->memberList[i].port);
+        }
+    }
+    this->config = config;
+    for(size_t i = 0; i < memberNode->memberList.size(); i++)     // timeouts or the detector may have changed
+    {
+        armMemberTimer(&memberNode->memberList[i]);
+    }
+}
+
+const MP1Config &MP1Node::getConfig()
+{
+    return config;
+}
+
+// the listed members on the consistent hash ring, empty unless config.ringVirtualNodes > 0
+const HashRing &MP1Node::getRing()
+{
+    return ring;
+}
+
+// numToGossip, raised to fanoutLogScale * log2(N) when that is set so a rumor still reaches everyone
+// in about log(N) rounds as the cluster grows
+int MP1Node::gossipFanout()
+{
+    int fanout = config.numToGossip;
+    size_t numMembers = memberNode->memberList.size();
+    if(config.fanoutLogScale > 0 && numMembers > 1)
+    {
+        fanout = max(fanout, (int)ceil(config.fanoutLogScale * log2((double)numMembers)));
+    }
+    return fanout;
+}
+
+// how many gossipTime periods pass between gossip rounds. with gossipStretch set it grows by one per
+// gossipStretch members, which keeps the full list bytes per tick flat. TFAIL and TREMOVE grow with it
+// so slower heartbeats are not taken for failures
+int MP1Node::gossipStretch()
+{
+    if(config.gossipStretch <= 0)
+    {
+        return 1;
+    }
+    return 1 + (int)(memberNode->memberList.size() / config.gossipStretch);
+}
+
+// PING and ACK carry a sequence number, PINGREQ also the member to ping.
+// all three end with the piggybacked updates that have been sent the fewest times
+void MP1Node::sendProbeMessage(MsgTypes type, Address *sendTo, long seq, Address *target)
+{
+    int numUpdates = min((int)updates.size(), config.maxPiggyback);
+
+    msgBuilder.begin(type, &memberNode->addr, memberNode->heartbeat, incarnation,
+                     3 * MAXVARINTSIZE + numUpdates * (1 + MAXENTRYSIZE));
+    msgBuilder.writeVarint(seq);
+    if(type == PINGREQ)
+    {
+        msgBuilder.writeAddress(target);
+    }
+
+    stable_sort(updates.begin(), updates.end(), updateSentLess);
+    msgBuilder.writeVarint(numUpdates);
+    for(int i = 0; i < numUpdates; i++)
+    {
+        Address updateAddress;
+        memcpy(&updateAddress.addr[0], &updates[i].id, sizeof(int));
+        memcpy(&updateAddress.addr[4], &updates[i].port, sizeof(short));
+        msgBuilder.writeByte((unsigned char)updates[i].kind);
+        msgBuilder.writeAddress(&updateAddress);
+        msgBuilder.writeVersion(updates[i].heartbeat - memberNode->heartbeat, updates[i].incarnation);
+        updates[i].transmissions--;
+    }
+    updates.erase(remove_if(updates.begin(), updates.end(), updateSpent), updates.end());
+    METRIC_ADD(bytesEncoded, msgBuilder.size());
+
+    sendMessage(sendTo, msgBuilder.data(), msgBuilder.size());
+}
+
+// handles PING, PINGREQ and ACK. the piggybacked updates are decoded whole before any is applied
+bool MP1Node::recvProbeMessage(MsgTypes type, Address *fromAddress, long fromHeartbeat, MessageView *receivedMsg)
+{
+    unsigned long long seq;
+    unsigned long long numUpdates;
+    Address target;
+
+    if(!receivedMsg->readVarint(&seq) ||
+       (type == PINGREQ && !receivedMsg->readAddress(&target)) ||
+       !receivedMsg->readVarint(&numUpdates) || numUpdates > receivedMsg->remaining() / MINUPDATESIZE)
+    {
+        return false;
+    }
+
+    updateBatch.clear();
+    for(unsigned long long i = 0; i < numUpdates; i++)
+    {
+        unsigned char kind;
+        Address updateAddress;
+        long heartbeatDelta;
+        MembershipUpdate update;
+        if(!receivedMsg->readByte(&kind) || kind > LEAVE_UPDATE ||
+           !receivedMsg->readAddress(&updateAddress) || !receivedMsg->readVersion(&heartbeatDelta, &update.incarnation))
+        {
+            return false;
+        }
+        update.kind = (UpdateKind)kind;
+        memcpy(&update.id, &updateAddress.addr[0], sizeof(int));
+        memcpy(&update.port, &updateAddress.addr[4], sizeof(short));
+        update.heartbeat = fromHeartbeat + heartbeatDelta;
+        update.transmissions = 0;
+        updateBatch.push_back(update);
+    }
+    METRIC_ADD(entriesDecoded, updateBatch.size());
+    for(size_t i = 0; i < updateBatch.size(); i++)
+    {
+        applyUpdate(&updateBatch[i]);
+    }
+
+    switch(type)
+    {
+        case(PING):
+            sendProbeMessage(ACK, fromAddress, seq, NULL);
+            break;
+        case(PINGREQ):      // ping the target for the sender and pass its ack back
+        {
+            ProbeState relay;
+            relay.target = target;
+            relay.origin = *fromAddress;
+            relay.originSeq = seq;
+            relay.seq = ++probeSeq;
+            relay.sentAt = par->getcurrtime();
+            relay.indirect = false;
+            relay.active = true;
+            relays.push_back(relay);
+            sendProbeMessage(PING, &target, relay.seq, NULL);
+            break;
+        }
+        case(ACK):
+            if(probe.active && (long)seq == probe.seq)
+            {
+                probe.active = false;
+                break;
+            }
+            for(size_t i = 0; i < relays.size(); i++)
+            {
+                if(relays[i].seq == (long)seq)
+                {
+                    sendProbeMessage(ACK, &relays[i].origin, relays[i].originSeq, NULL);
+                    relays[i] = relays.back();
+                    relays.pop_back();
+                    break;
+                }
+            }
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// puts an update in the piggyback buffer, replacing any older update about the same member.
+// it is sent RETRANSMITMULT * log2(N) times so it reaches everyone with high probability
+void MP1Node::queueUpdate(UpdateKind kind, int id, short port, long heartbeat, long memberIncarnation)
+{
+    int transmissions = config.retransmitMult;
+    for(size_t numMembers = memberNode->memberList.size(); numMembers > 1; numMembers >>= 1)
+    {
+        transmissions += config.retransmitMult;
+    }
+
+    MembershipUpdate update = {kind, id, port, heartbeat, memberIncarnation, transmissions};
+    for(size_t i = 0; i < updates.size(); i++)
+    {
+        if(updates[i].id == id && updates[i].port == port)
+        {
+            updates[i] = update;
+            return;
+        }
+    }
+    updates.push_back(update);
+}
+
+// SWIM merge rules over (incarnation, heartbeat), see isNewer: ALIVE wins over what we know if it
+// is newer, SUSPECT if it is at least as new, CONFIRM and LEAVE if they are of the same incarnation
+// or a later one. news that this node is suspected is refuted by moving to the next incarnation
+void MP1Node::applyUpdate(MembershipUpdate *update)
+{
+    int myID;
+    short myPort;
+    memcpy(&myID, &memberNode->addr.addr[0], sizeof(int));
+    memcpy(&myPort, &memberNode->addr.addr[4], sizeof(short));
+
+    if(update->id == myID && update->port == myPort)
+    {
+        if(update->kind == ALIVE_UPDATE ? isNewer(update->incarnation, update->heartbeat, incarnation, memberNode->heartbeat)
+                                        : !isNewer(incarnation, memberNode->heartbeat, update->incarnation, update->heartbeat))
+        {
+            refuteNews(update->kind, update->incarnation, update->heartbeat);
+        }
+        return;
+    }
+
+    MemberListEntry *entry = findMember(update->id, update->port);
+    long entryIncarnation = entry == NULL ? 0 : incarnationOf(entry);
+    switch(update->kind)
+    {
+        case(ALIVE_UPDATE):
+            if(entry == NULL)
+            {
+                if(admitMember(update->id, update->port, update->heartbeat, update->incarnation))
+                {
+                    queueUpdate(ALIVE_UPDATE, update->id, update->port, update->heartbeat, update->incarnation);
+                }
+                else
+                {
+                    requeueLeave(update->id, update->port);     // stale news of a member that left, spread the leave again
+                }
+            }
+            else if(isNewer(update->incarnation, update->heartbeat, entryIncarnation, entry->heartbeat))
+            {
+                METRIC_ADD(entriesMerged, 1);
+                setVersion(entry, update->heartbeat, update->incarnation);
+                setMemberStatus(entry, MEMBER_ALIVE);
+                armMemberTimer(entry);
+                queueUpdate(ALIVE_UPDATE, update->id, update->port, update->heartbeat, update->incarnation);
+            }
+            break;
+        case(SUSPECT_UPDATE):
+            if(entry != NULL && !isNewer(entryIncarnation, entry->heartbeat, update->incarnation, update->heartbeat) &&
+               (memberTable.statusAt(memberTable.positionOf(entry)) != MEMBER_SUSPECT ||
+                isNewer(update->incarnation, update->heartbeat, entryIncarnation, entry->heartbeat)))
+            {
+                entry->heartbeat = update->heartbeat;
+                memberTable.stateOf(entry).incarnation = update->incarnation;
+                suspectMember(entry);
+            }
+            break;
+        case(CONFIRM_UPDATE):
+            if(entry != NULL && update->incarnation >= entryIncarnation)    // an older one is from before it came back
+            {
+                queueUpdate(CONFIRM_UPDATE, update->id, update->port, update->heartbeat, update->incarnation);
+                failMember(entry);
+            }
+            break;
+        case(LEAVE_UPDATE):
+            if(entry != NULL && update->incarnation >= entryIncarnation)
+            {
+                queueUpdate(LEAVE_UPDATE, update->id, update->port, update->heartbeat, update->incarnation);
+                entry->heartbeat = update->heartbeat;
+                memberTable.stateOf(entry).incarnation = update->incarnation;
+                tombstoneMember(entry, MEMBER_LEFT);
+            }
+            break;
+    }
+}
+
+void MP1Node::suspectMember(MemberListEntry *entry)
+{
+    setMemberStatus(entry, MEMBER_SUSPECT);
+    armMemberTimer(entry);
+    queueUpdate(SUSPECT_UPDATE, entry->id, entry->port, entry->heartbeat, incarnationOf(entry));
+}
+
+// piggyback order: updates with the most transmissions left, i.e. sent the fewest times, first
+bool MP1Node::updateSentLess(const MembershipUpdate &first, const MembershipUpdate &second)
+{
+    return first.transmissions > second.transmissions;
+}
+
+// an update that has been piggybacked as often as queueUpdate asked for
+bool MP1Node::updateSpent(const MembershipUpdate &update)
+{
+    return update.transmissions <= 0;
+}
+
+#ifdef MP1METRICS
+// ********  METRICS ************ //
+
+NodeMetrics MP1Node::getMetrics()
+{
+    return metrics;
+}
+
+// counts since the node started, then each handler's latency in cycles. p50 and p99 are bucket upper bounds
+void MP1Node::logMetrics()
+{
+#ifdef DEBUGLOG
+    static const char *handlerNames[NUMHANDLERS] = {"checkMessages", "recvCallBack", "nodeLoopOps"};
+    std::lock_guard<std::mutex> guard(logLock);     // METRICSTIME logs from inside nodeLoop
+    log->LOG(&memberNode->addr, "metrics: recv joinreq %ld joinrep %ld gossip %ld ping %ld pingreq %ld ack %ld leave %ld rejected %ld",
+             metrics.received[JOINREQ], metrics.received[JOINREP], metrics.received[GOSSIP], metrics.received[PING],
+             metrics.received[PINGREQ], metrics.received[ACK], metrics.received[LEAVE], metrics.rejected);
+    log->LOG(&memberNode->addr, "metrics: bytes encoded %ld decoded %ld, entries decoded %ld merged %ld added %ld removed %ld",
+             metrics.bytesEncoded, metrics.bytesDecoded, metrics.entriesDecoded, metrics.entriesMerged,
+             metrics.entriesAdded, metrics.entriesRemoved);
+    for(int handler = 0; handler < NUMHANDLERS; handler++)
+    {
+        LatencyHistogram *latency = &metrics.latency[handler];
+        if(latency->count == 0)
+        {
+            continue;
+        }
+        log->LOG(&memberNode->addr, "metrics: %s %ld calls, cycles avg %llu p50 %llu p99 %llu max %llu",
+                 handlerNames[handler], latency->count, latency->total / latency->count,
+                 latency->percentile(0.5), latency->percentile(0.99), latency->max);
+    }
+#endif
+}
+#endif
+
+#ifdef MP1BINARYLOG
+// ********  BINARY LOG ************ //
+
+// queues what logNodeAdd or logNodeRemove would have written, for the writer thread
+void MP1Node::logRecord(LogRecordKind kind, Address *subject)
+{
+    LogRecord record;
+    memset(&record, 0, sizeof(record));
+    record.time = par->getcurrtime();
+    record.kind = (unsigned char)kind;
+    memcpy(record.observer, memberNode->addr.addr, sizeof(record.observer));
+    memcpy(record.subject, subject->addr, sizeof(record.subject));
+    logRing->push(record);
+}
+
+LogRing::LogRing() : records(LOGRINGSIZE), head(0), tail(0) {}
+
+// waits for the writer when the ring is full, records are never dropped
+void LogRing::push(const LogRecord &record)
+{
+    size_t position = head.load(std::memory_order_relaxed);
+    while(position - tail.load(std::memory_order_acquire) >= LOGRINGSIZE)
+    {
+        std::this_thread::yield();
+    }
+    records[position & (LOGRINGSIZE - 1)] = record;
+    head.store(position + 1, std::memory_order_release);
+}
+
+// writes every queued record to fp and returns how many there were. only the writer calls this
+size_t LogRing::drain(FILE *fp)
+{
+    size_t first = tail.load(std::memory_order_relaxed);
+    size_t last = head.load(std::memory_order_acquire);
+    size_t position = first;
+
+    while(position < last)      // at most two runs, before and after the wrap
+    {
+        size_t start = position & (LOGRINGSIZE - 1);
+        size_t count = min(last - position, (size_t)LOGRINGSIZE - start);
+        fwrite(&records[start], sizeof(LogRecord), count, fp);
+        position += count;
+    }
+    tail.store(last, std::memory_order_release);
+    return last - first;
+}
+
+BinaryLogWriter::BinaryLogWriter() : running(false)
+{
+    int header[2] = {BINARYLOGMAGIC, (int)sizeof(LogRecord)};
+    fp = fopen(BINARYLOGFILE, "wb");
+    if(fp == NULL)
+    {
+        cout << "could not open " << BINARYLOGFILE << endl;
+        exit(1);
+    }
+    fwrite(header, sizeof(header), 1, fp);
+}
+
+// stops the thread, then writes what is left in the rings of nodes that were never deleted
+BinaryLogWriter::~BinaryLogWriter()
+{
+    if(running.exchange(false))
+    {
+        thread.join();
+    }
+    drainAll();
+    fclose(fp);
+}
+
+BinaryLogWriter &BinaryLogWriter::instance()
+{
+    static BinaryLogWriter writer;
+    return writer;
+}
+
+void BinaryLogWriter::run()
+{
+    while(running.load())
+    {
+        if(drainAll() == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOGWRITERSLEEP));
+        }
+    }
+}
+
+size_t BinaryLogWriter::drainAll()
+{
+    std::lock_guard<std::mutex> guard(ringsLock);
+    size_t drained = 0;
+    for(size_t i = 0; i < rings.size(); i++)
+    {
+        drained += rings[i]->drain(fp);
+    }
+    return drained;
+}
+
+void BinaryLogWriter::attach(LogRing *ring)
+{
+    std::lock_guard<std::mutex> guard(ringsLock);
+    rings.push_back(ring);
+    if(!running.exchange(true))
+    {
+        thread = std::thread(&BinaryLogWriter::run, this);
+    }
+}
+
+// writes the ring's last records before the node deletes it
+void BinaryLogWriter::detach(LogRing *ring)
+{
+    std::lock_guard<std::mutex> guard(ringsLock);
+    ring->drain(fp);
+    rings.erase(remove(rings.begin(), rings.end(), ring), rings.end());
+}
+#endif
+
+// ********  MEMBER STATUS ************ //
+
+// moves a listed member to ALIVE or SUSPECT and counts the transition
+void MP1Node::setMemberStatus(MemberListEntry *entry, MemberStatus status)
+{
+    int position = memberTable.positionOf(entry);
+    MemberState &state = memberTable.stateAt(position);
+    MemberStatus oldStatus = memberTable.statusAt(position);
+    long latency;
+
+    if(oldStatus == status)
+    {
+        return;
+    }
+    latency = (status == MEMBER_ALIVE) ? par->getcurrtime() - state.statusSince : par->getcurrtime() - entry->timestamp;
+    recordTransition(oldStatus, status, latency);
+    memberTable.setStatus(position, status);
+    state.statusSince = par->getcurrtime();
+}
+
+// tombstones a member that stopped answering
+void MP1Node::failMember(MemberListEntry *entry)
+{
+    tombstoneMember(entry, MEMBER_FAILED);
+}
+
+// removes the member and keeps a tombstone with its last heartbeat for TTOMBSTONE. status is
+// MEMBER_FAILED or MEMBER_LEFT, and says which it was
+void MP1Node::tombstoneMember(MemberListEntry *entry, MemberStatus status)
+{
+    int id = entry->id;
+    short port = entry->port;
+    bool added;
+
+    recordTransition(memberTable.statusAt(memberTable.positionOf(entry)), status, par->getcurrtime() - entry->timestamp);
+    MemberListEntry *tombstone = tombstones.insert(id, port, entry->heartbeat, par->getcurrtime(), &added);
+    tombstone->heartbeat = entry->heartbeat;       // the entry was admitted past any older tombstone
+    tombstones.stateOf(tombstone).incarnation = incarnationOf(entry);
+    tombstones.setStatus(tombstones.positionOf(tombstone), status);
+    tombstones.stateOf(tombstone).statusSince = par->getcurrtime();
+    if(added)
+    {
+        tombstones.stateOf(tombstone).timer = tombstoneTimers.schedule(id, port, par->getcurrtime() + config.tTombstone + 1);
+    }
+    else
+    {
+        tombstoneTimers.reschedule(tombstones.stateOf(tombstone).timer, par->getcurrtime() + config.tTombstone + 1);
+    }
+
+    removeMemberFromMembershipList(id, port);
+}
+
+// adds a member we just heard about, unless it is a removed member and the news is no newer than
+// the version it had when it was removed. newer news means a failure was a mistake. a member that
+// left said so itself, only a later incarnation brings it back
+bool MP1Node::admitMember(int id, short port, long heartbeat, long memberIncarnation)
+{
+    MemberListEntry *tombstone = tombstones.find(id, port);
+
+    if(tombstone != NULL)
+    {
+        long tombstoneIncarnation = tombstones.stateOf(tombstone).incarnation;
+        if(tombstones.statusAt(tombstones.positionOf(tombstone)) == MEMBER_LEFT ? memberIncarnation <= tombstoneIncarnation
+                                                                             : !isNewer(memberIncarnation, heartbeat, tombstoneIncarnation, tombstone->heartbeat))
+        {
+            return false;       // stale gossip about a dead member
+        }
+        recordTransition(tombstones.statusAt(tombstones.positionOf(tombstone)), MEMBER_ALIVE,
+                         par->getcurrtime() - tombstones.stateOf(tombstone).statusSince);
+        removeTombstone(id, port);
+    }
+    addMemberToMembershipList(id, port, heartbeat, memberIncarnation);
+    return true;
+}
+
+// forgets members removed more than TTOMBSTONE ago
+void MP1Node::purgeTombstones()
+{
+    tombstoneTimers.advance(par->getcurrtime(), &expiredTimers);
+    for(size_t i = 0; i < expiredTimers.size(); i++)
+    {
+        tombstones.remove(expiredTimers[i].first, expiredTimers[i].second);
+    }
+}
+
+void MP1Node::removeTombstone(int id, short port)
+{
+    MemberListEntry *tombstone = tombstones.find(id, port);
+    if(tombstone == NULL)
+    {
+        return;
+    }
+    tombstoneTimers.cancel(tombstones.stateOf(tombstone).timer);
+    tombstones.remove(id, port);
+}
+
+// keeps the member's timer on its next deadline: TFAIL or TREMOVE after it was last heard from with the
+// heartbeat detector, TSUSPECT after it was suspected with SWIM. called whenever either changes
+void MP1Node::armMemberTimer(MemberListEntry *entry)
+{
+    MemberState &state = memberTable.stateOf(entry);
+    MemberStatus status = memberTable.statusAt(memberTable.positionOf(entry));
+    long deadline = -1;
+    int myID;
+    short myPort;
+    memcpy(&myID, &memberNode->addr.addr[0], sizeof(int));
+    memcpy(&myPort, &memberNode->addr.addr[4], sizeof(short));
+
+    if(entry->id == myID && entry->port == myPort)
+    {
+        return;     // this node never times out of its own list
+    }
+    if(config.failureDetector == HEARTBEAT_DETECTOR)
+    {
+        deadline = entry->timestamp + (status == MEMBER_SUSPECT ? config.tRemove : config.tFail) * gossipStretch() + 1;
+    }
+    else if(status == MEMBER_SUSPECT)
+    {
+        deadline = state.statusSince + config.tSuspect + 1;
+    }
+
+    if(deadline < 0)
+    {
+        memberTimers.cancel(state.timer);
+        state.timer = -1;
+    }
+    else if(state.timer < 0)
+    {
+        state.timer = memberTimers.schedule(entry->id, entry->port, deadline);
+    }
+    else
+    {
+        memberTimers.reschedule(state.timer, deadline);
+    }
+}
+
+// handles every member whose deadline came up since the last call
+void MP1Node::expireMemberTimers()
+{
+    memberTimers.advance(par->getcurrtime(), &expiredTimers);
+    // the wheel already freed these timers, forget them before any handler schedules new ones
+    for(size_t i = 0; i < expiredTimers.size(); i++)
+    {
+        MemberListEntry *entry = findMember(expiredTimers[i].first, expiredTimers[i].second);
+        if(entry != NULL)
+        {
+            memberTable.stateOf(entry).timer = -1;
+        }
+    }
+    for(size_t i = 0; i < expiredTimers.size(); i++)
+    {
+        MemberListEntry *entry = findMember(expiredTimers[i].first, expiredTimers[i].second);
+        if(entry != NULL)
+        {
+            memberTimerExpired(entry);
+        }
+    }
+}
+
+// if heartbeat has not increased for TFAIL the member is suspected, after TREMOVE it is removed.
+// a SWIM suspect that did not refute within TSUSPECT is removed and everyone is told
+void MP1Node::memberTimerExpired(MemberListEntry *entry)
+{
+    int position = memberTable.positionOf(entry);
+    MemberState &state = memberTable.stateAt(position);
+    long currTime = par->getcurrtime();
+
+    if(config.failureDetector == SWIM_DETECTOR)
+    {
+        if(memberTable.statusAt(position) == MEMBER_SUSPECT && state.statusSince + config.tSuspect < currTime)
+        {
+            queueUpdate(CONFIRM_UPDATE, entry->id, entry->port, entry->heartbeat, incarnationOf(entry));
+            failMember(entry);
+            return;
+        }
+    }
+    else if(entry->timestamp + config.tRemove * gossipStretch() < currTime)
+    {
+        failMember(entry);
+        return;
+    }
+    else if(entry->timestamp + config.tFail * gossipStretch() < currTime)
+    {
+        setMemberStatus(entry, MEMBER_SUSPECT);
+    }
+    armMemberTimer(entry);
+}
+
+void MP1Node::recordTransition(MemberStatus from, MemberStatus to, long latency)
+{
+    TransitionStats *stats = &transitions[from][to];
+    stats->count++;
+    stats->latencyTotal += latency;
+    stats->latencyMax = max(stats->latencyMax, latency);
+}
+
+TransitionStats MP1Node::getTransitionStats(MemberStatus from, MemberStatus to)
+{
+    return transitions[from][to];
+}
+
+// write each status transition that happened, with its latency. transitions to alive are false positives
+void MP1Node::logTransitionStats()
+{
+#ifdef DEBUGLOG
+    static const char *statusNames[NUMMEMBERSTATUSES] = {"alive", "suspect", "failed", "left"};
+    for(int from = 0; from < NUMMEMBERSTATUSES; from++)
+    {
+        for(int to = 0; to < NUMMEMBERSTATUSES; to++)
+        {
+            TransitionStats *stats = &transitions[from][to];
+            if(stats->count == 0)
+            {
+                continue;
+            }
+            log->LOG(&memberNode->addr, "%s -> %s: %ld times, latency avg %ld max %ld%s",
+                     statusNames[from], statusNames[to], stats->count, stats->latencyTotal / stats->count,
+                     stats->latencyMax, to == MEMBER_ALIVE ? " (false positives)" : "");
+        }
+    }
+#endif
+}
+
+// ********  INCARNATION ************ //
+
+// true if (incarnation, heartbeat) is later than (thanIncarnation, thanHeartbeat). a member's
+// heartbeat starts over when it restarts, its incarnation never goes back, so it is compared first
+bool MP1Node::isNewer(long incarnation, long heartbeat, long thanIncarnation, long thanHeartbeat)
+{
+    return incarnation != thanIncarnation ? incarnation > thanIncarnation : heartbeat > thanHeartbeat;
+}
+
+long MP1Node::incarnationOf(MemberListEntry *entry)
+{
+    return memberTable.stateOf(entry).incarnation;
+}
+
+// takes newer news of a member, which was heard from just now
+void MP1Node::setVersion(MemberListEntry *entry, long heartbeat, long memberIncarnation)
+{
+    entry->heartbeat = heartbeat;
+    entry->timestamp = par->getcurrtime();
+    memberTable.stateOf(entry).incarnation = memberIncarnation;
+    memberTable.setChanged(memberTable.positionOf(entry), par->getcurrtime());
+}
+
+// news of this node that is newer than what it says of itself is from an earlier life of it,
+// or with SWIM a suspicion. the node takes an incarnation past it, which outranks the news at every
+// member at once. an ALIVE entry an introducer made for it at its next incarnation is just taken
+void MP1Node::refuteNews(UpdateKind kind, long newsIncarnation, long newsHeartbeat)
+{
+    int myID;
+    short myPort;
+    memcpy(&myID, &memberNode->addr.addr[0], sizeof(int));
+    memcpy(&myPort, &memberNode->addr.addr[4], sizeof(short));
+
+    incarnation = max(incarnation, newsIncarnation);
+    if(kind != ALIVE_UPDATE || isNewer(newsIncarnation, newsHeartbeat, incarnation, memberNode->heartbeat))
+    {
+        incarnation++;
+    }
+    MemberListEntry *myEntry = findMember(myID, myPort);
+    if(myEntry != NULL)
+    {
+        setVersion(myEntry, memberNode->heartbeat, incarnation);
+    }
+    if(config.failureDetector == SWIM_DETECTOR)
+    {
+        queueUpdate(ALIVE_UPDATE, myID, myPort, memberNode->heartbeat, incarnation);
+    }
+}
+
+// adds a member asking to join. one this node lists at a newer version than the JOINREQ's, or
+// has a tombstone for, has restarted: it goes on at the incarnation after the old one, which the
+// JOINREP tells it and which outranks what the rest of the group still has of its earlier life
+void MP1Node::admitJoiner(int id, short port, long heartbeat, long joinIncarnation)
+{
+    MemberListEntry *entry = findMember(id, port);
+    MemberListEntry *tombstone = tombstones.find(id, port);
+
+    if(entry != NULL && isNewer(incarnationOf(entry), entry->heartbeat, joinIncarnation, heartbeat))
+    {
+        joinIncarnation = incarnationOf(entry) + 1;
+    }
+    else if(entry == NULL && tombstone != NULL && joinIncarnation <= tombstones.stateOf(tombstone).incarnation)
+    {
+        joinIncarnation = tombstones.stateOf(tombstone).incarnation + 1;
+    }
+    removeTombstone(id, port);      // asking to join outranks any record of it failing
+
+    if(entry == NULL)
+    {
+        addMemberToMembershipList(id, port, heartbeat, joinIncarnation);
+    }
+    else if(isNewer(joinIncarnation, heartbeat, incarnationOf(entry), entry->heartbeat))
+    {
+        setVersion(entry, heartbeat, joinIncarnation);
+        setMemberStatus(entry, MEMBER_ALIVE);
+        armMemberTimer(entry);
+    }
+    if(config.failureDetector == SWIM_DETECTOR)     // probes carry the news of the join to everyone else
+    {
+        queueUpdate(ALIVE_UPDATE, id, port, heartbeat, joinIncarnation);
+    }
+}
+
+// ********  GRACEFUL LEAVE ************ //
+
+// tells gossipFanout members this node is leaving. the tombstones left behind outrank any gossip
+// about this incarnation of the node still going round, see admitMember. drivers call it before
+// finishUpThisNode, while the network still delivers
+void MP1Node::leaveGroup()
+{
+    if(!memberNode->inGroup || memberNode->bFailed)
+    {
+        return;
+    }
+    sendLeave(&memberNode->addr, memberNode->heartbeat, incarnation, NULL);
+    flushSends();       // nothing else will send for this node
+    transport->flush();
+}
+
+// sends a LEAVE about leaver to sendTo, or to gossipFanout random members other than it if NULL
+void MP1Node::sendLeave(Address *leaver, long heartbeat, long leaverIncarnation, Address *sendTo)
+{
+    int numTargets = 1;
+    SharedPayload payload;
+
+    if(sendTo == NULL)
+    {
+        numTargets = sampleMembers(gossipFanout(), leaver);
+        gossipTargets.resize(numTargets);
+        for(int i = 0; i < numTargets; i++)
+        {
+            memcpy(&gossipTargets[i].addr[0], &memberNode->memberList[samplePositions[i]].id, sizeof(int));
+            memcpy(&gossipTargets[i].addr[4], &memberNode->memberList[samplePositions[i]].port, sizeof(short));
+        }
+        sendTo = gossipTargets.data();
+    }
+    if(numTargets == 0)
+    {
+        return;
+    }
+    msgBuilder.begin(LEAVE, &memberNode->addr, memberNode->heartbeat, incarnation, MAXENTRYSIZE);
+    msgBuilder.writeAddress(leaver);
+    msgBuilder.writeVersion(heartbeat, leaverIncarnation);
+    METRIC_ADD(bytesEncoded, msgBuilder.size());
+    payload = msgBuilder.share();
+    sendPayload(payload, sendTo, numTargets);
+}
+
+// the member named in the LEAVE goes straight to a tombstone and the news goes on to gossipFanout
+// others, and rides on the probes under SWIM. a member already gone ends the relay, so each member
+// pushes a leave once, members the push misses hear it when they next gossip about the member.
+// false if the message is cut short
+bool MP1Node::recvLeave(MessageView *receivedMsg)
+{
+    Address leaver;
+    long heartbeat;
+    long leaverIncarnation;
+    int id;
+    short port;
+
+    if(!receivedMsg->readAddress(&leaver) || !receivedMsg->readVersion(&heartbeat, &leaverIncarnation))
+    {
+        return false;
+    }
+    memcpy(&id, &leaver.addr[0], sizeof(int));
+    memcpy(&port, &leaver.addr[4], sizeof(short));
+    MemberListEntry *entry = findMember(id, port);
+    if(entry == NULL || leaver == memberNode->addr || leaverIncarnation < incarnationOf(entry))
+    {
+        return true;    // a leave of an earlier incarnation is from before the member came back
+    }
+    entry->heartbeat = heartbeat;
+    memberTable.stateOf(entry).incarnation = leaverIncarnation;
+    tombstoneMember(entry, MEMBER_LEFT);
+    if(config.failureDetector == SWIM_DETECTOR)
+    {
+        queueUpdate(LEAVE_UPDATE, id, port, heartbeat, leaverIncarnation);
+    }
+    sendLeave(&leaver, heartbeat, leaverIncarnation, NULL);
+    return true;
+}
+
+// the tombstone of id/port if the member left rather than failed, NULL otherwise
+MemberListEntry *MP1Node::findLeftMember(int id, short port)
+{
+    MemberListEntry *tombstone = tombstones.find(id, port);
+
+    if(tombstone == NULL || tombstones.statusAt(tombstones.positionOf(tombstone)) != MEMBER_LEFT)
+    {
+        return NULL;
+    }
+    return tombstone;
+}
+
+// sendTo gossiped a member we have no entry for. if that member left, sendTo missed the LEAVE
+void MP1Node::answerLeftMember(int id, short port, Address *sendTo)
+{
+    MemberListEntry *tombstone = findLeftMember(id, port);
+    Address leaver;
+
+    if(tombstone == NULL)
+    {
+        return;
+    }
+    memcpy(&leaver.addr[0], &id, sizeof(int));
+    memcpy(&leaver.addr[4], &port, sizeof(short));
+    sendLeave(&leaver, tombstone->heartbeat, tombstones.stateOf(tombstone).incarnation, sendTo);
+}
+
+// the SWIM side of answerLeftMember: updates are not answered one sender at a time, the leave goes
+// back on the piggyback buffer and reaches whoever still lists the member
+void MP1Node::requeueLeave(int id, short port)
+{
+    MemberListEntry *tombstone = findLeftMember(id, port);
+
+    if(tombstone != NULL)
+    {
+        queueUpdate(LEAVE_UPDATE, id, port, tombstone->heartbeat, tombstones.stateOf(tombstone).incarnation);
+    }
+}
+
+// ********  SNAPSHOT ************ //
+
+// SNAPSHOTFILE.id.port in the working directory, one per member so members sharing a directory
+// do not write over each other
+string MP1Node::snapshotPath()
+{
+    int myID;
+    short myPort;
+    memcpy(&myID, &memberNode->addr.addr[0], sizeof(int));
+    memcpy(&myPort, &memberNode->addr.addr[4], sizeof(short));
+    return string(SNAPSHOTFILE) + "." + to_string((unsigned int)myID) + "." + to_string((unsigned short)myPort);
+}
+
+// writes every member on the list but this one to snapshotPath(). tombstones are left out, the
+// members that keep them go on gossiping them. the file is written under another name and renamed
+// over the old one, so a member failing halfway leaves the last snapshot whole
+bool MP1Node::saveSnapshot()
+{
+    string path = snapshotPath();
+    string tmpPath = path + ".tmp";
+    SnapshotHeader header;
+    int myID;
+    short myPort;
+    memcpy(&myID, &memberNode->addr.addr[0], sizeof(int));
+    memcpy(&myPort, &memberNode->addr.addr[4], sizeof(short));
+
+    snapshotEntries.clear();
+    for(size_t i = 0; i < memberNode->memberList.size(); i++)
+    {
+        MemberListEntry *entry = &memberNode->memberList[i];
+        if(entry->id == myID && entry->port == myPort)
+        {
+            continue;
+        }
+        SnapshotEntry saved;
+        memset(&saved, 0, sizeof(saved));       // padding is written too
+        saved.id = entry->id;
+        saved.port = entry->port;
+        saved.heartbeat = entry->heartbeat;
+        saved.incarnation = incarnationOf(entry);
+        snapshotEntries.push_back(saved);
+    }
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOTMAGIC;
+    header.entrySize = sizeof(SnapshotEntry);
+    header.heartbeat = memberNode->heartbeat;
+    header.incarnation = incarnation;
+    header.numEntries = snapshotEntries.size();
+
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if(fp == NULL)
+    {
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                   fwrite(snapshotEntries.data(), sizeof(SnapshotEntry), snapshotEntries.size(), fp) == snapshotEntries.size();
+    written = fclose(fp) == 0 && written;
+    if(!written || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// maps snapshotPath() and takes the members in it back through restoreSnapshot. returns how many
+// it took, 0 when there is no snapshot this build can read
+int MP1Node::loadSnapshot()
+{
+    string path = snapshotPath();
+    int numLoaded = 0;
+#ifdef __linux__
+    struct stat fileStat;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return 0;
+    }
+    if(fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        void *mapped = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped != MAP_FAILED)
+        {
+            numLoaded = restoreSnapshot((const char *)mapped, fileStat.st_size);
+            munmap(mapped, fileStat.st_size);
+        }
+    }
+    ::close(fd);
+#else
+    FILE *fp = fopen(path.c_str(), "rb");
+    vector<char> contents;
+    char chunk[4096];
+    size_t numRead;
+    if(fp == NULL)
+    {
+        return 0;
+    }
+    while((numRead = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    {
+        contents.insert(contents.end(), chunk, chunk + numRead);
+    }
+    fclose(fp);
+    numLoaded = restoreSnapshot(contents.data(), contents.size());
+#endif
+    return numLoaded;
+}
+
+// puts the members of a snapshot on the list as suspects, a heartbeat behind what was saved so the
+// first news of each brings it back to ALIVE even if it has not moved since. with SWIM that news is
+// the ack to the PING each is sent here. a member not heard from goes the way of any suspect.
+// this node goes on at the incarnation after the saved one, which outranks old gossip about it
+// and the tombstones of its leave
+int MP1Node::restoreSnapshot(const char *bytes, size_t size)
+{
+    SnapshotHeader header;
+    int numLoaded = 0;
+    int myID;
+    short myPort;
+    memcpy(&myID, &memberNode->addr.addr[0], sizeof(int));
+    memcpy(&myPort, &memberNode->addr.addr[4], sizeof(short));
+
+    if(size < sizeof(header))
+    {
+        return 0;
+    }
+    memcpy(&header, bytes, sizeof(header));
+    if(header.magic != SNAPSHOTMAGIC || header.entrySize != (int)sizeof(SnapshotEntry) || header.numEntries <= 0 ||
+       (size_t)header.numEntries > (size - sizeof(header)) / sizeof(SnapshotEntry))
+    {
+        return 0;
+    }
+
+    incarnation = max(incarnation, header.incarnation + 1);
+    memberTable.reserve(header.numEntries + 1);
+    addMemberToMembershipList(myID, myPort, memberNode->heartbeat, incarnation);
+    for(long i = 0; i < header.numEntries; i++)
+    {
+        SnapshotEntry saved;
+        memcpy(&saved, bytes + sizeof(header) + i * sizeof(SnapshotEntry), sizeof(saved));
+        if((saved.id == myID && saved.port == myPort) || findMember(saved.id, saved.port) != NULL)
+        {
+            continue;
+        }
+        addMemberToMembershipList(saved.id, saved.port, saved.heartbeat - 1, saved.incarnation);
+        MemberListEntry *entry = findMember(saved.id, saved.port);
+        int position = memberTable.positionOf(entry);
+        memberTable.setStatus(position, MEMBER_SUSPECT);     // not a transition, it was never seen alive
+        memberTable.stateAt(position).statusSince = par->getcurrtime();
+        armMemberTimer(entry);
+        numLoaded++;
+
+        if(config.failureDetector == SWIM_DETECTOR)
+        {
+            Address savedAddress;
+            memcpy(&savedAddress.addr[0], &saved.id, sizeof(int));
+            memcpy(&savedAddress.addr[4], &saved.port, sizeof(short));
+            sendProbeMessage(PING, &savedAddress, ++probeSeq, NULL);
+        }
+    }
+    return numLoaded;
+}
+
+// ********  INBOX ************ //
+
+Inbox::Inbox() : slots(new Slot[INBOXSIZE]), tail(0), head(0), dropped(0)
+{
+    for(size_t i = 0; i < INBOXSIZE; i++)
+    {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+// a slot is free for the push at position when its sequence is position, and the drain
+// at position may take it once the sequence is position + 1. false when the ring is full
+bool Inbox::push(char *data, int size)
+{
+    size_t position = tail.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    while(true)
+    {
+        slot = &slots[position & (INBOXSIZE - 1)];
+        long ahead = (long)(slot->sequence.load(std::memory_order_acquire) - position);
+        if(ahead == 0)
+        {
+            if(tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(ahead < 0)      // the slot still holds the message from one lap ago
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else                    // another producer claimed it first
+        {
+            position = tail.load(std::memory_order_relaxed);
+        }
+    }
+    slot->message.data = data;
+    slot->message.size = size;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+// claims room for the whole batch with one compare and swap. the owner frees slots in order, so
+// if the last slot wanted is free the ones before it are too. what does not fit is dropped and
+// left for the caller to free. returns how many were pushed, the first ones of the batch
+int Inbox::pushBatch(InboxMessage *batch, int numMessages)
+{
+    size_t position = tail.load(std::memory_order_relaxed);
+    int numFree;
+
+    while(true)
+    {
+        numFree = numMessages;
+        while(numFree > 0)
+        {
+            size_t last = position + numFree - 1;
+            if((long)(slots[last & (INBOXSIZE - 1)].sequence.load(std::memory_order_acquire) - last) >= 0)
+            {
+                break;
+            }
+            numFree--;
+        }
+        if(numFree == 0 || tail.compare_exchange_weak(position, position + numFree, std::memory_order_relaxed))
+        {
+            break;
+        }
+    }
+    for(int i = 0; i < numFree; i++)
+    {
+        Slot *slot = &slots[(position + i) & (INBOXSIZE - 1)];
+        slot->message = batch[i];
+        slot->sequence.store(position + i + 1, std::memory_order_release);
+    }
+    dropped.fetch_add(numMessages - numFree, std::memory_order_relaxed);
+    return numFree;
+}
+
+// moves up to maxMessages messages into batch in arrival order. only the owning node calls this
+int Inbox::drain(InboxMessage *batch, int maxMessages)
+{
+    int numMessages = 0;
+
+    while(numMessages < maxMessages)
+    {
+        Slot *slot = &slots[head & (INBOXSIZE - 1)];
+        if(slot->sequence.load(std::memory_order_acquire) != head + 1)
+        {
+            break;
+        }
+        batch[numMessages++] = slot->message;
+        slot->sequence.store(head + INBOXSIZE, std::memory_order_release);
+        head++;
+    }
+    return numMessages;
+}
+
+// frees every waiting message and returns how many there were. only the owning node calls this
+int Inbox::discard()
+{
+    InboxMessage batch[INBOXBATCH];
+    int numMessages;
+    int numDiscarded = 0;
+
+    while((numMessages = drain(batch, INBOXBATCH)) > 0)
+    {
+        for(int i = 0; i < numMessages; i++)
+        {
+            free(batch[i].data);
+        }
+        numDiscarded += numMessages;
+    }
+    return numDiscarded;
+}
+
+// ********  TRANSPORT ************ //
+
+EmulNetTransport::EmulNetTransport(EmulNet *emulNet) : emulNet(emulNet) {}
+
+// the message EmulNet malloc'd for us goes into the inbox, a full inbox drops it
+int EmulNetTransport::enqueue(void *env, char *buff, int size)
+{
+    if(!((Inbox *)env)->push(buff, size))
+    {
+        free(buff);
+        return false;
+    }
+    return true;
+}
+
+// one send per target, for transports with nothing better
+int Transport::sendMany(Address *from, Address *to, int numTargets, char *data, int size)
+{
+    int numSent = 0;
+    for(int i = 0; i < numTargets; i++)
+    {
+        if(send(from, &to[i], data, size) > 0)
+        {
+            numSent++;
+        }
+    }
+    return numSent;
+}
+
+// just the join address, for transports that only know one introducer. never more than numSeeds
+void Transport::getSeedAddresses(int /* numSeeds */, vector<Address> *seeds)
+{
+    seeds->assign(1, getJoinAddress());
+}
+
+int EmulNetTransport::send(Address *from, Address *to, char *data, int size)
+{
+    return emulNet->ENsend(from, to, data, size);
+}
+
+int EmulNetTransport::recv(Address *myaddr, Inbox *inbox)
+{
+    return emulNet->ENrecv(myaddr, enqueue, NULL, 1, inbox);
+}
+
+Address EmulNetTransport::getJoinAddress()
+{
+    Address joinaddr;
+
+    joinaddr.init();
+    *(int *)(&joinaddr.addr) = 1;
+    *(short *)(&joinaddr.addr[4]) = 0;
+
+    return joinaddr;
+}
+
+// nodes 1 to numSeeds, each at port 0 like the join address
+void EmulNetTransport::getSeedAddresses(int numSeeds, vector<Address> *seeds)
+{
+    seeds->clear();
+    for(int id = 1; id <= max(numSeeds, 1); id++)
+    {
+        Address seed = getJoinAddress();
+        *(int *)(&seed.addr) = id;
+        seeds->push_back(seed);
+    }
+}
+
+#ifdef __linux__
+UdpTransport::UdpTransport() : sock(-1), epollFd(-1), recvBytes(UDPBATCH * UDPMAXMSG), dropped(0)
+{
+}
+
+UdpTransport::~UdpTransport()
+{
+    flush();
+    if(sock >= 0)
+    {
+        close(sock);
+    }
+    if(epollFd >= 0)
+    {
+        close(epollFd);
+    }
+}
+
+// binds the socket to bindAddress and remembers who to send JOINREQs to, the first seed boots the
+// group. false if the socket fails
+bool UdpTransport::open(Address *bindAddress, const vector<Address> &seedAddresses)
+{
+    sockaddr_in local = toSockaddr(bindAddress);
+    int bufferSize = UDPSOCKBUF;
+    epoll_event event;
+
+    this->seedAddresses = seedAddresses;
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if(sock < 0)
+    {
+        return false;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    if(bind(sock, (sockaddr *)&local, sizeof(local)) < 0)
+    {
+        return false;
+    }
+    epollFd = epoll_create1(0);
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = sock;
+    return epollFd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &event) == 0;
+}
+
+// queues the datagram, a full batch goes out at once. returns size, or 0 if it can never be sent
+int UdpTransport::send(Address *from, Address *to, char *data, int size)
+{
+    return sendMany(from, to, 1, data, size) > 0 ? size : 0;
+}
+
+// queues the bytes once and a datagram per target pointing at them
+int UdpTransport::sendMany(Address * /* from */, Address *to, int numTargets, char *data, int size)
+{
+    UdpDatagram datagram;
+
+    if(size > UDPMAXMSG)
+    {
+        dropped += numTargets;
+        return 0;
+    }
+    datagram.offset = sendBytes.size();
+    datagram.size = size;
+    sendBytes.insert(sendBytes.end(), data, data + size);
+    for(int i = 0; i < numTargets; i++)
+    {
+        datagram.to = toSockaddr(&to[i]);
+        sendQueue.push_back(datagram);
+    }
+    if(sendQueue.size() >= UDPBATCH)
+    {
+        flush();
+    }
+    return numTargets;
+}
+
+// hands every queued datagram to the kernel, UDPBATCH per sendmmsg. returns how many it took
+int UdpTransport::flush()
+{
+    mmsghdr messages[UDPBATCH];
+    iovec parts[UDPBATCH];
+    size_t first = 0;
+    int numSent = 0;
+
+    while(first < sendQueue.size())
+    {
+        int count = (int)min((size_t)UDPBATCH, sendQueue.size() - first);
+        for(int i = 0; i < count; i++)
+        {
+            UdpDatagram *datagram = &sendQueue[first + i];
+            parts[i].iov_base = &sendBytes[datagram->offset];
+            parts[i].iov_len = datagram->size;
+            memset(&messages[i], 0, sizeof(mmsghdr));
+            messages[i].msg_hdr.msg_name = &datagram->to;
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            messages[i].msg_hdr.msg_iov = &parts[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        int sent = sendmmsg(sock, messages, count, 0);
+        if(sent < count)    // the datagram the kernel refused is lost, as UDP would lose it, and the rest are tried again
+        {
+            sent = max(sent, 0);
+            dropped++;
+            count = sent + 1;
+        }
+        numSent += sent;
+        first += count;
+    }
+    sendBytes.clear();
+    sendQueue.clear();
+    return numSent;
+}
+
+// moves the datagrams waiting on the socket into inbox, UDPBATCH per recvmmsg and one inbox push
+// per batch. stops after INBOXSIZE so a flood cannot hold the node here, the rest wait in the socket
+int UdpTransport::recv(Address * /* myaddr */, Inbox *inbox)
+{
+    mmsghdr messages[UDPBATCH];
+    iovec parts[UDPBATCH];
+    InboxMessage batch[UDPBATCH];
+    int numReceived = 0;
+    int count;
+
+    for(int i = 0; i < UDPBATCH; i++)
+    {
+        parts[i].iov_base = &recvBytes[(size_t)i * UDPMAXMSG];
+        parts[i].iov_len = UDPMAXMSG;
+        memset(&messages[i], 0, sizeof(mmsghdr));
+        messages[i].msg_hdr.msg_iov = &parts[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    while(numReceived < INBOXSIZE && (count = recvmmsg(sock, messages, UDPBATCH, MSG_DONTWAIT, NULL)) > 0)
+    {
+        for(int i = 0; i < count; i++)
+        {
+            batch[i].size = messages[i].msg_len;
+            batch[i].data = (char *)malloc(batch[i].size);
+            memcpy(batch[i].data, parts[i].iov_base, batch[i].size);
+        }
+        for(int i = inbox->pushBatch(batch, count); i < count; i++)
+        {
+            free(batch[i].data);
+        }
+        numReceived += count;
+    }
+    return numReceived;
+}
+
+Address UdpTransport::getJoinAddress()
+{
+    return seedAddresses.front();
+}
+
+// the first numSeeds of the seeds given to open
+void UdpTransport::getSeedAddresses(int numSeeds, vector<Address> *seeds)
+{
+    size_t count = min(seedAddresses.size(), (size_t)max(numSeeds, 1));
+    seeds->assign(seedAddresses.begin(), seedAddresses.begin() + count);
+}
+
+// blocks until a datagram is waiting or timeoutMillis pass. returns 1 if one is waiting
+int UdpTransport::wait(int timeoutMillis)
+{
+    epoll_event event;
+    return epoll_wait(epollFd, &event, 1, timeoutMillis) > 0;
+}
+
+// "a.b.c.d:port" into an Address, false if it is not one
+bool UdpTransport::parseAddress(const char *text, Address *addr)
+{
+    string address(text);
+    size_t colon = address.find(':');
+    in_addr ip;
+    int port;
+
+    if(colon == string::npos || inet_pton(AF_INET, address.substr(0, colon).c_str(), &ip) != 1)
+    {
+        return false;
+    }
+    port = atoi(address.substr(colon + 1).c_str());
+    if(port <= 0 || port > 0xFFFF)
+    {
+        return false;
+    }
+    memcpy(&addr->addr[0], &ip, sizeof(ip));
+    *(short *)(&addr->addr[4]) = (short)port;
+    return true;
+}
+
+sockaddr_in UdpTransport::toSockaddr(Address *addr)
+{
+    sockaddr_in sockAddr;
+    memset(&sockAddr, 0, sizeof(sockAddr));
+    sockAddr.sin_family = AF_INET;
+    memcpy(&sockAddr.sin_addr, &addr->addr[0], sizeof(sockAddr.sin_addr));
+    sockAddr.sin_port = htons(*(unsigned short *)(&addr->addr[4]));
+    return sockAddr;
+}
+#endif
+
+// ********  FAST RANDOM ************ //
+
+FastRandom::FastRandom()
+{
+    seed(0);
+}
+
+// zero would stick, so the seed is run through splitmix64 first
+void FastRandom::seed(unsigned long long seed)
+{
+    seed += 0x9E3779B97F4A7C15ULL;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+    state = (seed ^ (seed >> 31)) | 1;
+}
+
+unsigned long long FastRandom::next()
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+// uniform in [0, bound), by multiplying instead of a modulo
+unsigned int FastRandom::below(unsigned int bound)
+{
+    return (unsigned int)(((next() >> 32) * bound) >> 32);
+}
+
+// ********  TIMER WHEEL ************ //
+
+TimerWheel::TimerWheel() : buckets(WHEELLEVELS * WHEELSIZE + 1, -1), now(0) {}
+
+// drops every timer and starts the clock at now
+void TimerWheel::reset(long now)
+{
+    timers.clear();
+    freeTimers.clear();
+    buckets.assign(WHEELLEVELS * WHEELSIZE + 1, -1);
+    this->now = now;
+}
+
+// the lowest level whose current block also holds the deadline, and the deadline's slot there
+int TimerWheel::bucketFor(long deadline)
+{
+    for(int level = 0; level < WHEELLEVELS; level++)
+    {
+        int shift = WHEELBITS * level;
+        if((deadline >> (shift + WHEELBITS)) == (now >> (shift + WHEELBITS)))
+        {
+            return level * WHEELSIZE + (int)((deadline >> shift) & (WHEELSIZE - 1));
+        }
+    }
+    return WHEELLEVELS * WHEELSIZE;
+}
+
+void TimerWheel::link(int timer)
+{
+    Timer &t = timers[timer];
+    t.bucket = bucketFor(t.deadline);
+    t.prev = -1;
+    t.next = buckets[t.bucket];
+    if(t.next >= 0)
+    {
+        timers[t.next].prev = timer;
+    }
+    buckets[t.bucket] = timer;
+}
+
+void TimerWheel::unlink(int timer)
+{
+    Timer &t = timers[timer];
+    if(t.prev >= 0)
+    {
+        timers[t.prev].next = t.next;
+    }
+    else
+    {
+        buckets[t.bucket] = t.next;
+    }
+    if(t.next >= 0)
+    {
+        timers[t.next].prev = t.prev;
+    }
+}
+
+// relinks every timer of the bucket against the current time, which puts them a level or more lower
+void TimerWheel::cascade(int bucket)
+{
+    int timer = buckets[bucket];
+    buckets[bucket] = -1;
+    while(timer >= 0)
+    {
+        int next = timers[timer].next;
+        link(timer);
+        timer = next;
+    }
+}
+
+// returns the timer's handle. a deadline that is already due fires on the next tick
+int TimerWheel::schedule(int id, short port, long deadline)
+{
+    int timer;
+    if(freeTimers.empty())
+    {
+        timer = (int)timers.size();
+        timers.push_back(Timer());
+    }
+    else
+    {
+        timer = freeTimers.back();
+        freeTimers.pop_back();
+    }
+    timers[timer].id = id;
+    timers[timer].port = port;
+    timers[timer].deadline = max(deadline, now + 1);
+    link(timer);
+    return timer;
+}
+
+void TimerWheel::reschedule(int timer, long deadline)
+{
+    unlink(timer);
+    timers[timer].deadline = max(deadline, now + 1);
+    link(timer);
+}
+
+// handles that are -1 or already fired are ignored
+void TimerWheel::cancel(int timer)
+{
+    if(timer < 0 || timers[timer].bucket < 0)
+    {
+        return;
+    }
+    unlink(timer);
+    timers[timer].bucket = -1;
+    freeTimers.push_back(timer);
+}
+
+// moves the clock to now one tick at a time and fills expired with the address of every timer that fired.
+// fired timers are freed
+void TimerWheel::advance(long now, vector<pair<int, short> > *expired)
+{
+    expired->clear();
+    while(this->now < now)
+    {
+        long tick = ++this->now;
+
+        // entering a new block at a level brings its slot of the level above down, highest level first
+        if((tick & ((1L << (WHEELBITS * WHEELLEVELS)) - 1)) == 0)
+        {
+            cascade(WHEELLEVELS * WHEELSIZE);
+        }
+        for(int level = WHEELLEVELS - 1; level > 0; level--)
+        {
+            int shift = WHEELBITS * level;
+            if((tick & ((1L << shift) - 1)) == 0)
+            {
+                cascade(level * WHEELSIZE + (int)((tick >> shift) & (WHEELSIZE - 1)));
+            }
+        }
+
+        int bucket = (int)(tick & (WHEELSIZE - 1));
+        int timer = buckets[bucket];
+        buckets[bucket] = -1;
+        while(timer >= 0)
+        {
+            Timer &t = timers[timer];
+            expired->push_back(make_pair(t.id, t.port));
+            t.bucket = -1;
+            freeTimers.push_back(timer);
+            timer = t.next;
+        }
+    }
+}
+
+// ********  MEMBER TABLE ************ //
+
+MemberTable::MemberTable() : list(NULL), mask(0) {}
+
+// packs the address into one key, id in the high bits and port in the low 16
+unsigned long long MemberTable::makeKey(int id, short port)
+{
+    return ((unsigned long long)(unsigned int)id << 16) | (unsigned short)port;
+}
+
+// fibonacci hashing spreads the mostly sequential ids across the slot array
+size_t MemberTable::homeSlot(unsigned long long key)
+{
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+// returns the slot holding key, or the empty slot where it would go
+size_t MemberTable::findSlot(unsigned long long key)
+{
+    size_t slot = homeSlot(key);
+    while(slots[slot].position >= 0 && slots[slot].key != key)
+    {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void MemberTable::placeInSlots(unsigned long long key, int position)
+{
+    size_t slot = findSlot(key);
+    slots[slot].key = key;
+    slots[slot].position = position;
+}
+
+// backward shift deletion: pull later entries of the probe run into the hole so no tombstones are needed
+void MemberTable::eraseSlot(size_t slot)
+{
+    size_t hole = slot;
+    size_t next = (hole + 1) & mask;
+    while(slots[next].position >= 0)
+    {
+        size_t home = homeSlot(slots[next].key);
+        // move next into the hole unless its home lies cyclically in (hole, next]
+        if(((next - home) & mask) >= ((next - hole) & mask))
+        {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    slots[hole].position = -1;
+}
+
+// capacity must be a power of two
+void MemberTable::rehash(size_t capacity)
+{
+    Slot empty = {0, -1};
+    slots.assign(capacity, empty);
+    mask = capacity - 1;
+    for(size_t i = 0; i < list->size(); i++)
+    {
+        placeInSlots(makeKey((*list)[i].id, (*list)[i].port), (int)i);
+    }
+}
+
+// index the given list. called again whenever the list is cleared or replaced
+void MemberTable::attach(vector<MemberListEntry> *list)
+{
+    size_t capacity = 16;
+    MemberState fresh = {-1, 0, -1, 0};
+    this->list = list;
+    states.assign(list->size(), fresh);
+    statuses.assign(list->size(), MEMBER_ALIVE);
+    changedRounds.assign(list->size(), 0);
+    keys.resize(list->size());
+    idOrder.resize(list->size());
+    for(size_t i = 0; i < list->size(); i++)
+    {
+        keys[i] = makeKey((*list)[i].id, (*list)[i].port);
+        idOrder[i] = (int)i;
+    }
+    sort(idOrder.begin(), idOrder.end(), [this](int first, int second) { return keys[first] < keys[second]; });
+    while(capacity < list->size() * 2)
+    {
+        capacity *= 2;
+    }
+    rehash(capacity);
+}
+
+// where key is, or would go, in idOrder
+size_t MemberTable::orderIndex(unsigned long long key)
+{
+    size_t low = 0;
+    size_t high = idOrder.size();
+    while(low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if(keys[idOrder[middle]] < key)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// returns where in the list the member is located, -1 if not there
+int MemberTable::position(int id, short port)
+{
+    return slots[findSlot(makeKey(id, port))].position;
+}
+
+MemberListEntry *MemberTable::find(int id, short port)
+{
+    int listPosition = position(id, port);
+    return listPosition < 0 ? NULL : &(*list)[listPosition];
+}
+
+// adds the member to the end of the list. an existing entry is returned untouched with added set to false
+MemberListEntry *MemberTable::insert(int id, short port, long heartbeat, long timestamp, bool *added)
+{
+    unsigned long long key = makeKey(id, port);
+    size_t slot = findSlot(key);
+
+    if(slots[slot].position >= 0)
+    {
+        *added = false;
+        return &(*list)[slots[slot].position];
+    }
+
+    MemberState fresh = {-1, timestamp, -1, 0};
+    list->emplace_back(id, port, heartbeat, timestamp);
+    states.push_back(fresh);
+    keys.push_back(key);
+    statuses.push_back(MEMBER_ALIVE);
+    changedRounds.push_back((int)timestamp);
+    idOrder.insert(idOrder.begin() + orderIndex(key), (int)list->size() - 1);
+    *added = true;
+    if(list->size() * 2 > slots.size())     // keep the load factor under one half
+    {
+        rehash(slots.size() * 2);
+    }
+    else
+    {
+        slots[slot].key = key;
+        slots[slot].position = (int)list->size() - 1;
+    }
+    return &list->back();
+}
+
+// removes the member by moving the last list entry into its place
+bool MemberTable::remove(int id, short port)
+{
+    size_t slot = findSlot(makeKey(id, port));
+    int listPosition = slots[slot].position;
+    int lastPosition = (int)list->size() - 1;
+
+    if(listPosition < 0)
+    {
+        return false;
+    }
+    eraseSlot(slot);
+    idOrder.erase(idOrder.begin() + orderIndex(keys[listPosition]));
+
+    if(listPosition != lastPosition)
+    {
+        MemberListEntry &last = (*list)[lastPosition];
+        slots[findSlot(keys[lastPosition])].position = listPosition;
+        idOrder[orderIndex(keys[lastPosition])] = listPosition;
+        (*list)[listPosition] = last;
+        states[listPosition] = states[lastPosition];
+        keys[listPosition] = keys[lastPosition];
+        statuses[listPosition] = statuses[lastPosition];
+        changedRounds[listPosition] = changedRounds[lastPosition];
+    }
+    list->pop_back();
+    states.pop_back();
+    keys.pop_back();
+    statuses.pop_back();
+    changedRounds.pop_back();
+    return true;
+}
+
+// positions of every entry's member in the list, -1 for those not in it. all the home slots are
+// worked out and prefetched before the first probe, so the cache misses of a large table overlap
+void MemberTable::findBatch(vector<MemberListEntry> &entries, vector<int> *positions)
+{
+    batchSlots.resize(entries.size());
+    positions->resize(entries.size());
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        batchSlots[i] = homeSlot(makeKey(entries[i].id, entries[i].port));
+        __builtin_prefetch(&slots[batchSlots[i]]);
+    }
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        unsigned long long key = makeKey(entries[i].id, entries[i].port);
+        size_t slot = batchSlots[i];
+        while(slots[slot].position >= 0 && slots[slot].key != key)
+        {
+            slot = (slot + 1) & mask;
+        }
+        (*positions)[i] = slots[slot].position;
+    }
+}
+
+// makes room for numMembers so inserting up to there neither moves list entries nor rehashes.
+// grows to at least twice the size, so reserving a little at a time stays amortized
+void MemberTable::reserve(size_t numMembers)
+{
+    size_t capacity = slots.size();
+    if(numMembers <= list->capacity() && numMembers * 2 <= capacity)
+    {
+        return;
+    }
+    numMembers = max(numMembers, list->size() * 2);
+    list->reserve(numMembers);
+    states.reserve(numMembers);
+    keys.reserve(numMembers);
+    statuses.reserve(numMembers);
+    changedRounds.reserve(numMembers);
+    idOrder.reserve(numMembers);
+    while(numMembers * 2 > capacity)
+    {
+        capacity *= 2;
+    }
+    if(capacity != slots.size())
+    {
+        rehash(capacity);
+    }
+}
+
+size_t MemberTable::size()
+{
+    return list->size();
+}
+
+MemberState &MemberTable::stateAt(int position)
+{
+    return states[position];
+}
+
+// entry must point into the attached list
+MemberState &MemberTable::stateOf(MemberListEntry *entry)
+{
+    return states[positionOf(entry)];
+}
+
+int MemberTable::positionOf(MemberListEntry *entry)
+{
+    return (int)(entry - &(*list)[0]);
+}
+
+MemberStatus MemberTable::statusAt(int position)
+{
+    return (MemberStatus)statuses[position];
+}
+
+void MemberTable::setStatus(int position, MemberStatus status)
+{
+    statuses[position] = status;
+}
+
+long MemberTable::changedAt(int position)
+{
+    return changedRounds[position];
+}
+
+void MemberTable::setChanged(int position, long round)
+{
+    changedRounds[position] = (int)round;
+}
+
+// sets bit i of marks for every alive entry i that changed after the given round, -1 for all of them,
+// and returns how many there are. SSE2 compares four entries of each column at once
+int MemberTable::markReportable(long changedAfter, vector<unsigned long long> *marks)
+{
+    size_t numMembers = list->size();
+    int after = (int)max(changedAfter, (long)INT_MIN);
+    int numMarked = 0;
+    size_t i = 0;
+
+    marks->assign((numMembers + 63) / 64, 0);
+#ifdef __SSE2__
+    __m128i alive = _mm_set1_epi32(MEMBER_ALIVE);
+    __m128i threshold = _mm_set1_epi32(after);
+    for(; i + 4 <= numMembers; i += 4)
+    {
+        __m128i isAlive = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&statuses[i]), alive);
+        __m128i isNewer = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)&changedRounds[i]), threshold);
+        unsigned long long bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(isAlive, isNewer)));
+        (*marks)[i / 64] |= bits << (i % 64);
+    }
+#endif
+    for(; i < numMembers; i++)
+    {
+        unsigned long long bit = (statuses[i] == MEMBER_ALIVE) & (changedRounds[i] > after);
+        (*marks)[i / 64] |= bit << (i % 64);
+    }
+    for(size_t word = 0; word < marks->size(); word++)
+    {
+        numMarked += __builtin_popcountll((*marks)[word]);
+    }
+    return numMarked;
+}
+
+// every position, ordered by id and then port
+const vector<int> &MemberTable::positionsByID()
+{
+    return idOrder;
+}
+
+// ********  HASH RING ************ //
+
+HashRing::HashRing() : numVirtual(0), numMembers(0) {}
+
+// the splitmix64 finalizer, a bijection on 64 bits that spreads neighbouring inputs over the ring
+unsigned long long HashRing::mix(unsigned long long value)
+{
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+// the member key fills the upper 48 bits and the index the lower 16, so every point is distinct
+unsigned long long HashRing::pointOf(unsigned long long memberKey, int index)
+{
+    return mix((memberKey << 16) | (unsigned int)index);
+}
+
+// empties the ring. members added from now on get numVirtual points each, 0 keeps it empty
+void HashRing::reset(int numVirtual)
+{
+    points.clear();
+    this->numVirtual = max(0, min(numVirtual, RINGMAXVNODES));
+    numMembers = 0;
+}
+
+// the caller adds a member once, as addMemberToMembershipList does for each new entry
+void HashRing::add(int id, short port)
+{
+    if(numVirtual == 0)
+    {
+        return;
+    }
+    unsigned long long memberKey = MemberTable::makeKey(id, port);
+    for(int i = 0; i < numVirtual; i++)
+    {
+        points.insert(make_pair(pointOf(memberKey, i), memberKey));
+    }
+    numMembers++;
+}
+
+void HashRing::remove(int id, short port)
+{
+    unsigned long long memberKey = MemberTable::makeKey(id, port);
+    size_t erased = 0;
+    for(int i = 0; i < numVirtual; i++)
+    {
+        erased += points.erase(pointOf(memberKey, i));
+    }
+    if(erased > 0)
+    {
+        numMembers--;
+    }
+}
+
+// members on the ring
+size_t HashRing::size() const
+{
+    return numMembers;
+}
+
+int HashRing::virtualNodes() const
+{
+    return numVirtual;
+}
+
+// FNV-1a of the name, mixed so names differing only in the last byte land far apart
+unsigned long long HashRing::hashKey(const string &name)
+{
+    unsigned long long hash = 0xCBF29CE484222325ULL;
+    for(size_t i = 0; i < name.size(); i++)
+    {
+        hash = (hash ^ (unsigned char)name[i]) * 0x100000001B3ULL;
+    }
+    return mix(hash);
+}
+
+// fills replicas with the first count distinct members clockwise from key, the owner first.
+// returns how many there are, fewer than count when the ring holds fewer members
+int HashRing::successors(unsigned long long key, int count, vector<Address> *replicas) const
+{
+    replicas->clear();
+    count = (int)min((size_t)max(count, 0), numMembers);
+    map<unsigned long long, unsigned long long>::const_iterator point = points.lower_bound(key);
+    for(size_t walked = 0; (int)replicas->size() < count && walked < points.size(); walked++, ++point)
+    {
+        if(point == points.end())     // wrap around past the top of the ring
+        {
+            point = points.begin();
+        }
+        Address owner;
+        int id = (int)(point->second >> 16);
+        short port = (short)(point->second & 0xFFFF);
+        memcpy(&owner.addr[0], &id, sizeof(int));
+        memcpy(&owner.addr[4], &port, sizeof(short));
+
+        bool seen = false;
+        for(size_t i = 0; i < replicas->size() && !seen; i++)     // count is a replication factor, a handful
+        {
+            seen = memcmp((*replicas)[i].addr, owner.addr, sizeof(owner.addr)) == 0;
+        }
+        if(!seen)
         {
-            return listLocation;
+            replicas->push_back(owner);
         }
-        listLocation++;
     }
-    return(-1); // no member found;
+    return (int)replicas->size();
 }
 
 /*
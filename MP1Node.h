@@ -14,14 +14,55 @@
 #include "Member.h"
 #include "EmulNet.h"
 #include "Queue.h"
+#include <memory>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <climits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef MP1BINARYLOG
+#include <thread>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
 
 /**
  * Macros
  */
 #define TREMOVE 20
 #define TFAIL 5			// HOW LONG TO WAIT TO DECLARE MEMBER FAILED
-#define NUMTOGOSSIP	3		// HOW MANY OTHER MEMBERS TO SEND THE RANDOM GOSSIP MESSAGE TO
+#define TTOMBSTONE	40		// HOW LONG A REMOVED MEMBER IS REMEMBERED SO STALE GOSSIP CANNOT BRING IT BACK
+#define NUMTOGOSSIP	3		// DEFAULT FAN-OUT, HOW MANY OTHER MEMBERS TO SEND THE RANDOM GOSSIP MESSAGE TO
 #define GOSSIPTIME	1		// HOW OFTEN TO GOSSIP
+#define GOSSIPMODE	FULL_GOSSIP	// FULL_GOSSIP SENDS THE WHOLE LIST EVERY ROUND, DELTA_GOSSIP ONLY WHAT CHANGED
+#define ANTIENTROPYTIME	10		// HOW OFTEN DELTA_GOSSIP SENDS THE WHOLE LIST ANYWAY TO COVER LOST MESSAGES
+#define FAILUREDETECTOR	HEARTBEAT_DETECTOR	// HEARTBEAT_DETECTOR GOSSIPS HEARTBEATS, SWIM_DETECTOR PROBES ONE MEMBER A PERIOD
+#define PROBETIME	6		// SWIM PROTOCOL PERIOD, ENOUGH FOR A PING, A PING-REQ AND THEIR ACKS
+#define PINGTIMEOUT	2		// HOW LONG TO WAIT FOR A DIRECT ACK BEFORE ASKING OTHERS TO PING
+#define NUMPINGREQ	3		// HOW MANY MEMBERS ARE ASKED TO PING A TARGET THAT DID NOT ACK
+#define TSUSPECT	24		// HOW LONG A SUSPECTED MEMBER HAS TO REFUTE BEFORE IT IS REMOVED, A FEW PROBE PERIODS
+#define MAXPIGGYBACK	6		// HOW MANY MEMBERSHIP UPDATES RIDE ON EACH PROBE MESSAGE
+#define RETRANSMITMULT	3		// EACH UPDATE IS PIGGYBACKED RETRANSMITMULT * LOG2(N) TIMES
+#define FANOUTLOGSCALE	0		// WHEN > 0 GOSSIP GOES TO AT LEAST FANOUTLOGSCALE * LOG2(N) MEMBERS
+#define GOSSIPSTRETCH	0		// WHEN > 0 THE GOSSIP INTERVAL AND TFAIL/TREMOVE GROW BY ONE STEP PER GOSSIPSTRETCH MEMBERS
+#define JOINSEEDS	1		// HOW MANY INTRODUCERS TAKE JOINREQS, IN EMULNET NODES 1 TO JOINSEEDS
+#define JOINTIMEOUT	10		// HOW LONG TO WAIT FOR A JOINREP BEFORE ASKING THE NEXT INTRODUCER
+#define JOINSAMPLE	64		// MOST MEMBERS A JOINREP LISTS, THE REST ARE LEARNED THROUGH GOSSIP. 0 LISTS ALL
+#define SNAPSHOTTIME	0		// WHEN > 0 EACH MEMBER CHECKPOINTS ITS LIST EVERY SNAPSHOTTIME TICKS AND RESTARTS FROM IT
+#define RINGVNODES	0		// WHEN > 0 EACH MEMBER KEEPS A CONSISTENT HASH RING WITH RINGVNODES POINTS PER LISTED MEMBER
+#define MP1CONFIGENV	"MP1_CONFIG"	// ENVIRONMENT VARIABLE NAMING A FILE THAT OVERRIDES THE VALUES ABOVE
+#define METRICSTIME	0		// WITH MP1METRICS, WHEN > 0 THE METRICS ARE ALSO LOGGED EVERY METRICSTIME TICKS
+#define LATENCYBUCKETS	64		// ONE HISTOGRAM BUCKET PER POWER OF TWO CYCLES
+#define SORTSHARE	8		// A GOSSIP OF UNDER 1/SORTSHARE OF THE MEMBERS SORTS ITS ENTRIES, A BIGGER ONE WALKS THE ID ORDER
 
 /*
  * Note: You can change/add any functions in MP1Node.{h,cpp}
@@ -34,9 +75,87 @@ enum MsgTypes{
     JOINREQ,
     JOINREP,
 	GOSSIP,
+    PING,
+    PINGREQ,
+    ACK,
+    LEAVE,
     DUMMYLASTMSGTYPE
 };
 
+/**
+ * Gossip Modes
+ */
+enum GossipMode{
+    FULL_GOSSIP,
+    DELTA_GOSSIP,
+    NUMGOSSIPMODES
+};
+
+/**
+ * Failure Detectors
+ */
+enum FailureDetector{
+    HEARTBEAT_DETECTOR,
+    SWIM_DETECTOR
+};
+
+/**
+ * Member Status
+ * 		ALIVE: heard from recently enough, gossiped to others
+ * 		SUSPECT: silent for TFAIL (or missed a SWIM probe), no longer gossiped, can still recover
+ * 		FAILED: silent for TREMOVE (or TSUSPECT as a SWIM suspect), removed and kept as a tombstone
+ * 		LEFT: said it was leaving, removed and kept as a tombstone like a failed member
+ */
+enum MemberStatus{
+    MEMBER_ALIVE,
+    MEMBER_SUSPECT,
+    MEMBER_FAILED,
+    MEMBER_LEFT,
+    NUMMEMBERSTATUSES
+};
+
+/**
+ * Membership Update Kinds, piggybacked on SWIM probe messages
+ */
+enum UpdateKind{
+    ALIVE_UPDATE,
+    SUSPECT_UPDATE,
+    CONFIRM_UPDATE,
+    LEAVE_UPDATE
+};
+
+/**
+ * STRUCT NAME: MP1Config
+ *
+ * DESCRIPTION: Protocol tuning, read at run time so experiments need no rebuild.
+ * 				Starts out as the macros above. The file named by MP1CONFIGENV overrides them with
+ * 				KEY: value lines, the layout of the testcase files, keyed by macro name. Other keys
+ * 				are skipped, so the settings can be appended to a testcase file
+ */
+typedef struct MP1Config {
+	long tRemove;
+	long tFail;
+	long tTombstone;
+	int numToGossip;
+	long gossipTime;
+	GossipMode gossipMode;
+	long antiEntropyTime;
+	FailureDetector failureDetector;
+	long probeTime;
+	long pingTimeout;
+	int numPingReq;
+	long tSuspect;
+	int maxPiggyback;
+	int retransmitMult;
+	double fanoutLogScale;
+	int gossipStretch;
+	int joinSeeds;
+	long joinTimeout;
+	int joinSample;
+	long snapshotTime;
+	int ringVirtualNodes;
+}MP1Config;
+
 /**
  * STRUCT NAME: MessageHdr
  *
@@ -46,6 +165,817 @@ typedef struct MessageHdr {
 	enum MsgTypes msgType;
 }MessageHdr;
 
+/**
+ * Wire Format
+ *
+ * Every message starts with version and type bytes, then the sender id, port and version.
+ * A GOSSIP message follows with the entry count and the entries sorted by id, each as
+ * id minus previous id, port, and version with the heartbeat taken from the sender heartbeat.
+ * A JOINREP carries the same count and entries, the introducer's list or a sample of it. A LEAVE
+ * follows with the id, port and version of the member leaving, which need not be the sender as
+ * LEAVEs are relayed. A version is the zigzagged heartbeat shifted up a bit, that bit set when
+ * the incarnation follows, so the usual incarnation 0 costs nothing.
+ * Integers are LEB128 varints, signed ones zigzag encoded first, so the format does not
+ * depend on the byte order or type sizes of either machine.
+ */
+#define WIREVERSION	3			// FIRST BYTE OF EVERY MESSAGE, BUMP WHEN THE ENCODING CHANGES
+#define MAXVARINTSIZE	10			// A 64 BIT VALUE IN 7 BIT GROUPS
+#define MAXSENDERSIZE	(2 + 4 * MAXVARINTSIZE)	// VERSION, TYPE, SENDER ID, PORT, HEARTBEAT AND INCARNATION
+#define MAXENTRYSIZE	(4 * MAXVARINTSIZE)	// ONE MEMBER ENTRY IN A GOSSIP MESSAGE
+#define MINENTRYSIZE	3			// EVERY ENTRY FIELD TAKES AT LEAST ONE BYTE
+#define MINUPDATESIZE	4			// KIND BYTE PLUS THE THREE ENTRY FIELDS OF A PIGGYBACKED UPDATE
+
+/**
+ * CLASS NAME: SharedPayload
+ *
+ * DESCRIPTION: Encoded message shared read-only by every destination it is sent to
+ * 				Copying the handle only bumps a reference count
+ */
+class SharedPayload {
+private:
+	shared_ptr<const vector<char> > buffer;
+	size_t length;
+
+public:
+	SharedPayload() : length(0) {}
+	SharedPayload(shared_ptr<const vector<char> > buffer, size_t length) : buffer(buffer), length(length) {}
+	const char *data() {
+		return &(*buffer)[0];
+	}
+	size_t size() {
+		return length;
+	}
+};
+
+/**
+ * CLASS NAME: MessageBuilder
+ *
+ * DESCRIPTION: Encodes outgoing messages into a buffer the node reuses for every send
+ * 				The buffer only grows, so steady state gossip does not touch the heap.
+ * 				share() hands the finished message out as a SharedPayload; while any payload
+ * 				still holds the buffer the next message is built in a fresh one
+ */
+class MessageBuilder {
+private:
+	shared_ptr<vector<char> > arena;
+	size_t position;
+
+	void ensure(size_t bytes) {
+		if (position + bytes > arena->size()) {
+			arena->resize(max(arena->size() * 2, position + bytes));
+		}
+	}
+
+public:
+	MessageBuilder() : position(0) {}
+	// starts a new message with the header, sender address and version
+	void begin(MsgTypes type, Address *from, long heartbeat, long incarnation, size_t payloadSize) {
+		if (!arena || arena.use_count() != 1) {
+			arena = make_shared<vector<char> >();
+		}
+		position = 0;
+		ensure(MAXSENDERSIZE + payloadSize);
+		writeByte(WIREVERSION);
+		writeByte((unsigned char)type);
+		writeAddress(from);
+		writeVersion(heartbeat, incarnation);
+	}
+	// id and port as two varints
+	void writeAddress(Address *addr) {
+		int id;
+		short port;
+		memcpy(&id, &addr->addr[0], sizeof(int));
+		memcpy(&port, &addr->addr[4], sizeof(short));
+		writeVarint((unsigned int)id);
+		writeVarint((unsigned short)port);
+	}
+	void writeByte(unsigned char value) {
+		ensure(1);
+		(*arena)[position++] = (char)value;
+	}
+	// 7 bits per byte, low bits first, high bit set on every byte but the last
+	void writeVarint(unsigned long long value) {
+		ensure(MAXVARINTSIZE);
+		while (value >= 0x80) {
+			(*arena)[position++] = (char)(value | 0x80);
+			value >>= 7;
+		}
+		(*arena)[position++] = (char)value;
+	}
+	// zigzag keeps small negative values small: 0, -1, 1, -2 ... become 0, 1, 2, 3 ...
+	void writeSigned(long long value) {
+		writeVarint(((unsigned long long)value << 1) ^ (value < 0 ? ~0ULL : 0ULL));
+	}
+	// heartbeat, which may be a difference, and incarnation, see Wire Format
+	void writeVersion(long long heartbeat, long long incarnation) {
+		unsigned long long zigzag = ((unsigned long long)heartbeat << 1) ^ (heartbeat < 0 ? ~0ULL : 0ULL);
+		writeVarint(zigzag << 1 | (incarnation != 0));
+		if (incarnation != 0) {
+			writeVarint(incarnation);
+		}
+	}
+	char *data() {
+		return &(*arena)[0];
+	}
+	size_t size() {
+		return position;
+	}
+	SharedPayload share() {
+		return SharedPayload(arena, position);
+	}
+};
+
+/**
+ * CLASS NAME: MessageView
+ *
+ * DESCRIPTION: Read-only cursor over a received message
+ * 				Reads are bounds checked and fail once they would run past the end of the message
+ */
+class MessageView {
+private:
+	const char *data;
+	size_t size;
+	size_t position;
+
+public:
+	MessageView(const char *data, size_t size) : data(data), size(size), position(0) {}
+	bool readByte(unsigned char *value) {
+		if (position >= size) {
+			return false;
+		}
+		*value = (unsigned char)data[position++];
+		return true;
+	}
+	bool readVarint(unsigned long long *value) {
+		unsigned long long result = 0;
+		unsigned char byte;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (!readByte(&byte)) {
+				return false;
+			}
+			result |= (unsigned long long)(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) {
+				*value = result;
+				return true;
+			}
+		}
+		return false;			// longer than any 64 bit value
+	}
+	bool readSigned(long *value) {
+		unsigned long long zigzag;
+		if (!readVarint(&zigzag)) {
+			return false;
+		}
+		*value = (long)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+		return true;
+	}
+	bool readAddress(Address *addr) {
+		unsigned long long id, port;
+		if (!readVarint(&id) || id > 0xFFFFFFFFULL || !readVarint(&port) || port > 0xFFFF) {
+			return false;
+		}
+		unsigned int addrId = (unsigned int)id;
+		unsigned short addrPort = (unsigned short)port;
+		memcpy(&addr->addr[0], &addrId, sizeof(int));
+		memcpy(&addr->addr[4], &addrPort, sizeof(short));
+		return true;
+	}
+	bool readVersion(long *heartbeat, long *incarnation) {
+		unsigned long long tagged;
+		unsigned long long value = 0;
+		if (!readVarint(&tagged) || ((tagged & 1) && (!readVarint(&value) || value > LONG_MAX))) {
+			return false;
+		}
+		unsigned long long zigzag = tagged >> 1;
+		*heartbeat = (long)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+		*incarnation = (long)value;
+		return true;
+	}
+	// reads what MessageBuilder::begin wrote. fails on another wire version or an unknown type
+	bool readSender(MessageHdr *header, Address *from, long *heartbeat, long *incarnation) {
+		unsigned char version, type;
+		if (!readByte(&version) || version != WIREVERSION ||
+			!readByte(&type) || type > DUMMYLASTMSGTYPE ||
+			!readAddress(from) || !readVersion(heartbeat, incarnation)) {
+			return false;
+		}
+		header->msgType = (MsgTypes)type;
+		return true;
+	}
+	size_t remaining() {
+		return size - position;
+	}
+};
+
+/**
+ * STRUCT NAME: GossipStats
+ *
+ * DESCRIPTION: Bytes and messages sent by the periodic gossip in one mode
+ */
+typedef struct GossipStats {
+	long rounds;
+	long messages;
+	long bytes;
+	long lastRoundBytes;
+}GossipStats;
+
+/**
+ * STRUCT NAME: TrafficStats
+ *
+ * DESCRIPTION: Every message this node handed to the network, whatever its type
+ */
+typedef struct TrafficStats {
+	long messages;
+	long bytes;
+}TrafficStats;
+
+/**
+ * Metrics
+ *
+ * Compile with -DMP1METRICS to count messages, bytes and entries and to time the handlers in
+ * cycles. Without it the METRIC_ macros expand to nothing and the node carries no metrics
+ */
+enum MetricHandler{
+    CHECKMESSAGES_HANDLER,
+    RECVCALLBACK_HANDLER,
+    NODELOOPOPS_HANDLER,
+    NUMHANDLERS
+};
+
+#ifdef MP1METRICS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * FUNCTION NAME: readCycles
+ *
+ * DESCRIPTION: Time stamp counter where there is one, nanoseconds elsewhere
+ */
+static inline unsigned long long readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/**
+ * STRUCT NAME: LatencyHistogram
+ *
+ * DESCRIPTION: Handler latencies in cycles. bucket b counts the ones in [2^b, 2^(b+1))
+ */
+typedef struct LatencyHistogram {
+	long count;
+	unsigned long long total;
+	unsigned long long max;
+	long buckets[LATENCYBUCKETS];
+	void record(unsigned long long cycles) {
+		count++;
+		total += cycles;
+		max = cycles > max ? cycles : max;
+		buckets[63 - __builtin_clzll(cycles | 1)]++;
+	}
+	// upper bound of the bucket holding the given fraction of the samples
+	unsigned long long percentile(double fraction) {
+		long seen = 0;
+		for (int b = 0; b < LATENCYBUCKETS; b++) {
+			seen += buckets[b];
+			if (seen > 0 && seen >= fraction * count) {
+				return b < 63 ? (2ULL << b) : max;
+			}
+		}
+		return 0;
+	}
+}LatencyHistogram;
+
+/**
+ * STRUCT NAME: NodeMetrics
+ *
+ * DESCRIPTION: Everything one node counted since it started
+ */
+typedef struct NodeMetrics {
+	long received[DUMMYLASTMSGTYPE + 1];	// messages handled, by type
+	long rejected;				// messages recvCallBack refused
+	long bytesEncoded;
+	long bytesDecoded;
+	long entriesDecoded;			// gossip entries and piggybacked updates read
+	long entriesMerged;			// of those, the ones that moved a member forward
+	long entriesAdded;
+	long entriesRemoved;
+	LatencyHistogram latency[NUMHANDLERS];
+}NodeMetrics;
+
+#define METRIC_ADD(field, n)			(metrics.field += (n))
+#define METRIC_TIMER_START(name)		unsigned long long name = readCycles()
+#define METRIC_TIMER_STOP(name, handler)	metrics.latency[handler].record(readCycles() - name)
+#else
+#define METRIC_ADD(field, n)			((void)0)
+#define METRIC_TIMER_START(name)		((void)0)
+#define METRIC_TIMER_STOP(name, handler)	((void)0)
+#endif
+
+/**
+ * Binary Log
+ *
+ * With -DMP1BINARYLOG (and -pthread) joins and removals are not formatted into dbg.log as they
+ * happen. Each node appends a fixed size LogRecord to its own LogRing, one BinaryLogWriter thread
+ * copies the rings into BINARYLOGFILE, and MP1LogDump turns that file back into dbg.log lines.
+ * The file starts with BINARYLOGMAGIC and sizeof(LogRecord), records are in the byte order of
+ * the machine that wrote them
+ */
+#define BINARYLOGFILE	"dbg.bin"
+#define BINARYLOGMAGIC	0x4C31504D		// "MP1L"
+#define LOGRINGSIZE	4096			// RECORDS PER NODE RING, A POWER OF TWO
+#define LOGWRITERSLEEP	1			// MILLISECONDS THE WRITER WAITS WHEN EVERY RING IS EMPTY
+
+enum LogRecordKind{
+    NODE_ADDED_RECORD,
+    NODE_REMOVED_RECORD
+};
+
+/**
+ * STRUCT NAME: LogRecord
+ *
+ * DESCRIPTION: observer added or removed subject at time
+ */
+typedef struct LogRecord {
+	int time;
+	unsigned char kind;
+	char observer[6];
+	char subject[6];
+	char reserved;
+}LogRecord;
+
+#ifdef MP1BINARYLOG
+/**
+ * CLASS NAME: LogRing
+ *
+ * DESCRIPTION: Single producer, single consumer ring of LogRecords.
+ * 				The node pushes, the writer thread drains, neither takes a lock
+ */
+class LogRing {
+private:
+	vector<LogRecord> records;
+	std::atomic<size_t> head;		// next record the node writes
+	std::atomic<size_t> tail;		// next record the writer reads
+
+public:
+	LogRing();
+	void push(const LogRecord &record);
+	size_t drain(FILE *fp);
+};
+
+/**
+ * CLASS NAME: BinaryLogWriter
+ *
+ * DESCRIPTION: The one thread that drains every attached ring into BINARYLOGFILE.
+ * 				Started by the first attach, stopped and flushed when the process exits
+ */
+class BinaryLogWriter {
+private:
+	FILE *fp;
+	vector<LogRing *> rings;
+	std::mutex ringsLock;			// held while rings is changed or drained
+	std::atomic<bool> running;
+	std::thread thread;
+
+	BinaryLogWriter();
+	void run();
+	size_t drainAll();
+
+public:
+	~BinaryLogWriter();
+	static BinaryLogWriter &instance();
+	void attach(LogRing *ring);
+	void detach(LogRing *ring);
+};
+#endif
+
+/**
+ * Snapshot
+ *
+ * With SNAPSHOTTIME set each member writes its list to SNAPSHOTFILE.id.port every SNAPSHOTTIME
+ * ticks and when it leaves. A member starting with a snapshot there takes the members in it as
+ * suspects and gossips with them at once instead of asking an introducer, they come back to ALIVE
+ * as soon as they are heard from. The file is a SnapshotHeader followed by numEntries
+ * SnapshotEntries in the byte order of the machine that wrote it, so it is read by mapping it
+ */
+#define SNAPSHOTFILE	"mp1snap"
+#define SNAPSHOTMAGIC	0x5331504D		// "MP1S"
+
+/**
+ * STRUCT NAME: SnapshotHeader
+ *
+ * DESCRIPTION: entrySize is sizeof(SnapshotEntry) so a file from another build is ignored
+ */
+typedef struct SnapshotHeader {
+	int magic;
+	int entrySize;
+	long heartbeat;				// the member's own heartbeat and incarnation when it wrote the file
+	long incarnation;
+	long numEntries;
+}SnapshotHeader;
+
+/**
+ * STRUCT NAME: SnapshotEntry
+ *
+ * DESCRIPTION: One member of the list as it was checkpointed
+ */
+typedef struct SnapshotEntry {
+	int id;
+	short port;
+	long heartbeat;
+	long incarnation;
+}SnapshotEntry;
+
+/**
+ * Inbox
+ *
+ * Messages EmulNet hands a node wait in a bounded ring until checkMessages takes them, up to
+ * INBOXBATCH at a time. Any thread may push, only the owning node drains. When the ring is full
+ * the message is dropped and counted, as a real network would drop it
+ */
+#define INBOXSIZE	1024			// MESSAGES WAITING PER NODE BEFORE DROPS, A POWER OF TWO
+#define INBOXBATCH	64			// MESSAGES CHECKMESSAGES TAKES OFF THE INBOX AT A TIME
+
+/**
+ * STRUCT NAME: InboxMessage
+ *
+ * DESCRIPTION: A received message, data is malloc'd and freed by whoever takes it off the inbox
+ */
+typedef struct InboxMessage {
+	char *data;
+	int size;
+}InboxMessage;
+
+/**
+ * CLASS NAME: Inbox
+ *
+ * DESCRIPTION: Bounded multiple producer, single consumer ring of InboxMessages.
+ * 				Each slot carries a sequence number that says whether it is free for the
+ * 				push at that position or holds a message for the drain at that position,
+ * 				so producers only contend on one compare and swap and nobody takes a lock
+ */
+class Inbox {
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		InboxMessage message;
+	};
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<size_t> tail;		// next position a producer claims
+	size_t head;				// next position the owner drains
+	std::atomic<long> dropped;
+
+public:
+	Inbox();
+	bool push(char *data, int size);
+	int pushBatch(InboxMessage *batch, int numMessages);
+	int drain(InboxMessage *batch, int maxMessages);
+	int discard();
+	long getDropped() {
+		return dropped.load(std::memory_order_relaxed);
+	}
+};
+
+/**
+ * Transport
+ *
+ * MP1Node sends and receives through a Transport. EmulNetTransport is the course's emulator,
+ * UdpTransport (Linux) sends real datagrams so a node can run as its own process. A UDP node's
+ * Address holds its IPv4 address in the first four bytes, network order, and its port in the
+ * last two, so the protocol and the wire format see a real address where the emulator puts
+ * an id and port 0
+ */
+#define UDPBATCH	64			// DATAGRAMS PER RECVMMSG OR SENDMMSG CALL
+#define UDPMAXMSG	65507			// LARGEST UDP PAYLOAD, LARGER SENDS ARE DROPPED
+#define UDPSOCKBUF	(4 << 20)		// SOCKET RECEIVE AND SEND BUFFER, IN BYTES
+
+/**
+ * CLASS NAME: Transport
+ *
+ * DESCRIPTION: Moves messages between nodes. send may hold messages until flush, sendMany
+ * 				sends one message to numTargets nodes and returns how many took it.
+ * 				recv moves the messages waiting for myaddr into inbox and returns how many.
+ * 				getJoinAddress is the introducer that boots the group, getSeedAddresses the first
+ * 				numSeeds introducers a JOINREQ may go to, at least one, fewer if the transport knows fewer
+ */
+class Transport {
+public:
+	virtual ~Transport() {}
+	virtual int send(Address *from, Address *to, char *data, int size) = 0;
+	virtual int sendMany(Address *from, Address *to, int numTargets, char *data, int size);
+	virtual int flush() {
+		return 0;
+	}
+	virtual int recv(Address *myaddr, Inbox *inbox) = 0;
+	virtual Address getJoinAddress() = 0;
+	virtual void getSeedAddresses(int numSeeds, vector<Address> *seeds);
+};
+
+/**
+ * CLASS NAME: EmulNetTransport
+ *
+ * DESCRIPTION: The emulated network every node of an Application shares. The introducer is node 1,
+ * 				the seeds are nodes 1 to numSeeds
+ */
+class EmulNetTransport : public Transport {
+private:
+	EmulNet *emulNet;
+
+	static int enqueue(void *env, char *buff, int size);
+
+public:
+	EmulNetTransport(EmulNet *emulNet);
+	int send(Address *from, Address *to, char *data, int size);
+	int recv(Address *myaddr, Inbox *inbox);
+	Address getJoinAddress();
+	void getSeedAddresses(int numSeeds, vector<Address> *seeds);
+};
+
+#ifdef __linux__
+/**
+ * STRUCT NAME: UdpDatagram
+ *
+ * DESCRIPTION: A queued send, its bytes are at offset in the send buffer and may be shared
+ * 				with the other destinations of the same message
+ */
+typedef struct UdpDatagram {
+	sockaddr_in to;
+	size_t offset;
+	int size;
+}UdpDatagram;
+
+/**
+ * CLASS NAME: UdpTransport
+ *
+ * DESCRIPTION: A non blocking UDP socket for one node. Sends are queued and go out UDPBATCH
+ * 				at a time through sendmmsg, a message for several targets is queued once.
+ * 				Receives come in UDPBATCH at a time through recvmmsg, at most an inbox full
+ * 				per recv. wait blocks in epoll until a datagram arrives or the timeout passes
+ */
+class UdpTransport : public Transport {
+private:
+	int sock;
+	int epollFd;
+	vector<Address> seedAddresses;		// the first one boots the group
+	vector<char> sendBytes;			// queued messages back to back
+	vector<UdpDatagram> sendQueue;
+	vector<char> recvBytes;			// UDPBATCH buffers of UDPMAXMSG bytes
+	long dropped;				// datagrams the kernel would not take
+
+public:
+	UdpTransport();
+	~UdpTransport();
+	bool open(Address *bindAddress, const vector<Address> &seedAddresses);
+	int send(Address *from, Address *to, char *data, int size);
+	int sendMany(Address *from, Address *to, int numTargets, char *data, int size);
+	int flush();
+	int recv(Address *myaddr, Inbox *inbox);
+	Address getJoinAddress();
+	void getSeedAddresses(int numSeeds, vector<Address> *seeds);
+	int wait(int timeoutMillis);
+	long getDropped() {
+		return dropped;
+	}
+	static bool parseAddress(const char *text, Address *addr);
+	static sockaddr_in toSockaddr(Address *addr);
+};
+#endif
+
+/**
+ * STRUCT NAME: OutboxMessage
+ *
+ * DESCRIPTION: A send held back until flushSends, its bytes are at offset in the outbox.
+ * 				The targets of one sendMessages share their bytes and sit next to each other
+ */
+typedef struct OutboxMessage {
+	Address to;
+	size_t offset;
+	int size;
+}OutboxMessage;
+
+/**
+ * STRUCT NAME: MemberState
+ *
+ * DESCRIPTION: Protocol bookkeeping kept next to each membership list entry.
+ * 				The status and the round the entry changed are scanned every gossip, so
+ * 				MemberTable keeps those in columns of their own
+ */
+typedef struct MemberState {
+	long lastSent;				// round this member last sent gossip to the entry's node, -1 if never
+	long statusSince;			// round the entry entered its status
+	int timer;				// the entry's deadline in the node's TimerWheel, -1 if none
+	long incarnation;			// raised by the member each time it restarts or refutes a suspicion
+}MemberState;
+
+/**
+ * STRUCT NAME: TransitionStats
+ *
+ * DESCRIPTION: How often members moved from one status to another and how long it took.
+ * 				Latency into SUSPECT, FAILED or LEFT is measured from when the member was last heard from,
+ * 				latency back to ALIVE is the time spent in the earlier status.
+ * 				Every transition back to ALIVE is a false positive
+ */
+typedef struct TransitionStats {
+	long count;
+	long latencyTotal;
+	long latencyMax;
+}TransitionStats;
+
+/**
+ * STRUCT NAME: MembershipUpdate
+ *
+ * DESCRIPTION: A change to one member waiting to be piggybacked on SWIM probe messages
+ */
+typedef struct MembershipUpdate {
+	UpdateKind kind;
+	int id;
+	short port;
+	long heartbeat;				// the member's heartbeat, which SWIM never raises
+	long incarnation;
+	int transmissions;			// how many more messages should carry it
+}MembershipUpdate;
+
+/**
+ * STRUCT NAME: ProbeState
+ *
+ * DESCRIPTION: The SWIM probe this member has outstanding, or one it relays for a PINGREQ
+ */
+typedef struct ProbeState {
+	Address target;
+	Address origin;				// who asked for the probe, for relays only
+	long seq;
+	long originSeq;				// sequence number to ack the origin with, for relays only
+	long sentAt;
+	bool indirect;				// PINGREQs went out because no direct ack came back
+	bool active;
+}ProbeState;
+
+/**
+ * Timer Wheel
+ *
+ * WHEELLEVELS levels of WHEELSIZE slots. A slot at level l spans WHEELSIZE^l ticks, so level 0
+ * resolves single ticks and the wheel covers WHEELSIZE^WHEELLEVELS ticks ahead. Deadlines further
+ * out than that wait in one overflow bucket
+ */
+#define WHEELBITS	6			// LOG2 OF WHEELSIZE
+#define WHEELSIZE	(1 << WHEELBITS)	// SLOTS PER LEVEL
+#define WHEELLEVELS	4			// 64^4 TICKS BEFORE A DEADLINE GOES TO OVERFLOW
+
+/**
+ * CLASS NAME: TimerWheel
+ *
+ * DESCRIPTION: Hierarchical timing wheel of per-member deadlines.
+ * 				A timer sits at the lowest level whose current block also holds its deadline and moves
+ * 				down a level when the clock enters its slot there, until it fires from level 0.
+ * 				Scheduling, rescheduling and cancelling are O(1), advancing only touches timers that
+ * 				move down or fire
+ */
+class TimerWheel {
+private:
+	struct Timer {
+		int id;
+		short port;
+		long deadline;
+		int prev;
+		int next;
+		int bucket;				// -1 while the timer is free
+	};
+	vector<Timer> timers;
+	vector<int> freeTimers;
+	vector<int> buckets;			// first timer in each slot, -1 if empty. the last bucket is overflow
+	long now;
+
+	int bucketFor(long deadline);
+	void link(int timer);
+	void unlink(int timer);
+	void cascade(int bucket);
+
+public:
+	TimerWheel();
+	void reset(long now);
+	int schedule(int id, short port, long deadline);
+	void reschedule(int timer, long deadline);
+	void cancel(int timer);
+	void advance(long now, vector<pair<int, short> > *expired);
+};
+
+/**
+ * CLASS NAME: FastRandom
+ *
+ * DESCRIPTION: xorshift64* generator. Each node owns one so runs can be replayed from a seed
+ * 				and nodes do not share the state of the global rand()
+ */
+class FastRandom {
+private:
+	unsigned long long state;
+
+public:
+	FastRandom();
+	void seed(unsigned long long seed);
+	unsigned long long next();
+	unsigned int below(unsigned int bound);
+};
+
+/**
+ * CLASS NAME: MemberTable
+ *
+ * DESCRIPTION: Hash index over the membership list keyed by (id, port)
+ * 				Entries stay in the member's memberList vector so it can still be walked in order,
+ * 				the index is an open-addressing (linear probing) slot array pointing into it.
+ * 				Removing an entry moves the last entry into its place.
+ * 				A MemberState is kept for every entry at the same position. The fields every
+ * 				gossip scans are columns at the same positions, so markReportable reads four
+ * 				entries per SSE2 compare, and idOrder keeps the positions sorted by key so a
+ * 				full list goes out in id order without sorting it each time.
+ */
+class MemberTable {
+private:
+	struct Slot {
+		unsigned long long key;
+		int position;				// index into the list, -1 if the slot is empty
+	};
+	vector<MemberListEntry> *list;
+	vector<MemberState> states;
+	vector<unsigned long long> keys;	// makeKey of each entry, ordered like (unsigned id, unsigned port)
+	vector<int> statuses;			// MemberStatus of each entry
+	vector<int> changedRounds;		// round each entry last changed in this member's list
+	vector<int> idOrder;			// positions by ascending key
+	vector<Slot> slots;
+	size_t mask;
+	vector<size_t> batchSlots;		// home slot of each findBatch key, reused
+
+	size_t homeSlot(unsigned long long key);
+	size_t findSlot(unsigned long long key);
+	void placeInSlots(unsigned long long key, int position);
+	void eraseSlot(size_t slot);
+	void rehash(size_t capacity);
+	size_t orderIndex(unsigned long long key);
+
+public:
+	MemberTable();
+	static unsigned long long makeKey(int id, short port);
+	void attach(vector<MemberListEntry> *list);
+	int position(int id, short port);
+	MemberListEntry *find(int id, short port);
+	MemberListEntry *insert(int id, short port, long heartbeat, long timestamp, bool *added);
+	bool remove(int id, short port);
+	void findBatch(vector<MemberListEntry> &entries, vector<int> *positions);
+	void reserve(size_t numMembers);
+	size_t size();
+	MemberState &stateAt(int position);
+	MemberState &stateOf(MemberListEntry *entry);
+	int positionOf(MemberListEntry *entry);
+	MemberStatus statusAt(int position);
+	void setStatus(int position, MemberStatus status);
+	long changedAt(int position);
+	void setChanged(int position, long round);
+	int markReportable(long changedAfter, vector<unsigned long long> *marks);
+	const vector<int> &positionsByID();
+};
+
+/**
+ * Hash Ring
+ *
+ * Every listed member owns ringVirtualNodes points on a 64 bit ring, hashed from its address and the
+ * point's index. A key belongs to the member owning the first point at or after the key's hash, its
+ * replicas to the next distinct members clockwise from there
+ */
+#define RINGMAXVNODES	(1 << 16)		// THE POINT INDEX FILLS THE 16 BITS BELOW THE MEMBER KEY
+
+/**
+ * CLASS NAME: HashRing
+ *
+ * DESCRIPTION: Consistent hash ring over the membership list, for placing replicas.
+ * 				The points are kept in a balanced tree, so a member joining or leaving costs
+ * 				O(V log NV) for V virtual nodes and N members and never rebuilds the ring.
+ * 				A point is the address and index run through the splitmix64 finalizer, which is a
+ * 				bijection, so two points never share a position
+ */
+class HashRing {
+private:
+	map<unsigned long long, unsigned long long> points;	// ring position to MemberTable::makeKey of its owner
+	int numVirtual;
+	size_t numMembers;
+
+	static unsigned long long mix(unsigned long long value);
+	static unsigned long long pointOf(unsigned long long memberKey, int index);
+
+public:
+	HashRing();
+	void reset(int numVirtual);
+	void add(int id, short port);
+	void remove(int id, short port);
+	size_t size() const;
+	int virtualNodes() const;
+	static unsigned long long hashKey(const string &name);
+	int successors(unsigned long long key, int count, vector<Address> *replicas) const;
+};
+
 /**
  * CLASS NAME: MP1Node
  *
@@ -53,14 +983,64 @@ typedef struct MessageHdr {
  */
 class MP1Node {
 private:
-	EmulNet *emulNet;
+	Transport *transport;
+	std::unique_ptr<Transport> ownTransport;	// the EmulNetTransport made for an EmulNet, if any
 	Log *log;
 	Params *par;
 	Member *memberNode;
+	MemberTable memberTable;
+	HashRing ring;				// the listed members, kept in step with memberTable when config.ringVirtualNodes > 0
+	MessageBuilder msgBuilder;
+	vector<MemberListEntry> entryBatch;	// gossip entries being encoded or decoded, reused
+	vector<long> entryIncarnations;		// the incarnation of each entry in entryBatch
+	vector<int> batchPositions;		// list positions of the entries being encoded, in id order
+	vector<unsigned long long> reportable;	// markReportable bits of the gossip being built, reused
+	vector<int> mergePositions;		// where each entry of a received list is in ours, -1 if new
+	vector<long> mergeHeartbeats;		// heartbeat of each received entry
+	vector<long> localHeartbeats;		// our heartbeat for it, LONG_MAX if we do not list it
+	vector<long> mergeIncarnations;		// incarnation of each received entry
+	vector<long> localIncarnations;		// ours for it, LONG_MAX if we do not list it
+	vector<unsigned char> mergeNewer;	// 1 where the received version is the newer one
+	MP1Config config;
+	GossipStats gossipStats[NUMGOSSIPMODES];
+	TrafficStats traffic;
+#ifdef MP1METRICS
+	NodeMetrics metrics;
+#endif
+#ifdef MP1BINARYLOG
+	LogRing *logRing;
+#endif
+	Inbox inbox;
+	bool bufferSends;			// sends wait in the outbox until flushSends
+	vector<char> outbox;
+	vector<OutboxMessage> outboxMessages;
+	static std::mutex logLock;		// Log is not thread safe and nodes may run on several threads
+	ProbeState probe;
+	vector<ProbeState> relays;
+	vector<MemberListEntry> tombstoneList;
+	MemberTable tombstones;			// members removed within the last TTOMBSTONE, with their last heartbeat
+	TimerWheel memberTimers;		// next TFAIL, TREMOVE or TSUSPECT deadline of each member
+	TimerWheel tombstoneTimers;		// when each tombstone expires
+	vector<pair<int, short> > expiredTimers;	// reused by every advance
+	TransitionStats transitions[NUMMEMBERSTATUSES][NUMMEMBERSTATUSES];	// [from][to]
+	vector<MembershipUpdate> updates;	// piggyback buffer, one update per member
+	vector<MembershipUpdate> updateBatch;	// updates decoded from one message, reused
+	long probeSeq;
+	FastRandom random;
+	vector<int> sampleOrder;		// list positions, shuffled a little more by every sample
+	vector<int> sampleFallback;		// suspects met while sampling, used when too few members are alive
+	vector<int> samplePositions;		// positions picked by the last sample
+	vector<Address> gossipTargets;
+	vector<Address> seeds;			// introducers other than this node
+	vector<SnapshotEntry> snapshotEntries;	// reused by every checkpoint
+	long incarnation;			// this node's, reset by a restart that has no snapshot
+	int joinAttempts;			// JOINREQs sent, the next goes to seeds[joinAttempts % size]
+	long joinSentAt;			// when the last JOINREQ went out
 	char NULLADDR[6];
 
 public:
 	MP1Node(Member *, Params *, EmulNet *, Log *, Address *);
+	MP1Node(Member *, Params *, Transport *, Log *, Address *);
 	Member * getMemberNode() {
 		return memberNode;
 	}
@@ -80,8 +1060,83 @@ public:
 	void printAddress(Address *addr);
 	virtual ~MP1Node();
 	//***** MY ADDED FUNCTIONS *****//
-	void addMemberToMembershipList(int id, short port, long heatbeat);
+	void addMemberToMembershipList(int id, short port, long heatbeat, long memberIncarnation);
 	void removeMemberFromMembershipList(int id, short port);
+	MemberListEntry *findMember(int id, short port);
+	void setGossipMode(GossipMode mode);
+	GossipStats getGossipStats(GossipMode mode);
+	void logGossipStats();
+	int buildMembershipList(long changedAfter, MsgTypes msgType);
+	int buildJoinReply(Address *joiner);
+	int encodeEntryBatch(MsgTypes msgType);
+	bool recvMembershipList(MessageView *receivedMsg, Address *fromAddress, long fromHeartbeat);
+	void batchMembers(vector<int> &positions);
+	void sendJoinRequest();
+	bool decodeMembershipList(MessageView *receivedMsg, unsigned long long numMembers, long fromHeartbeat);
+	void mergeMembershipList(Address *fromAddress);
+	static bool entryIDBefore(const MemberListEntry &first, const MemberListEntry &second);
+	bool isReportable(int position);
+	void setFailureDetector(FailureDetector detector);
+	void probeLoopOps();
+	void seedRandom(unsigned long long seed);
+	void setFanout(int fanout);
+	static MP1Config defaultConfig();
+	static bool loadConfig(const char *path, MP1Config *config);
+	static const MP1Config &sharedConfig();
+	void setConfig(const MP1Config &config);
+	const MP1Config &getConfig();
+	const HashRing &getRing();
+	int gossipFanout();
+	int gossipStretch();
+	int sampleMembers(int count, Address *exclude);
+	void sendProbeMessage(MsgTypes type, Address *sendTo, long seq, Address *target);
+	bool recvProbeMessage(MsgTypes type, Address *fromAddress, long fromHeartbeat, MessageView *receivedMsg);
+	void queueUpdate(UpdateKind kind, int id, short port, long heartbeat, long memberIncarnation);
+	void applyUpdate(MembershipUpdate *update);
+	void suspectMember(MemberListEntry *entry);
+	void setMemberStatus(MemberListEntry *entry, MemberStatus status);
+	void failMember(MemberListEntry *entry);
+	void tombstoneMember(MemberListEntry *entry, MemberStatus status);
+	void leaveGroup();
+	void sendLeave(Address *leaver, long heartbeat, long leaverIncarnation, Address *sendTo);
+	bool recvLeave(MessageView *receivedMsg);
+	MemberListEntry *findLeftMember(int id, short port);
+	void answerLeftMember(int id, short port, Address *sendTo);
+	void requeueLeave(int id, short port);
+	string snapshotPath();
+	bool saveSnapshot();
+	int loadSnapshot();
+	int restoreSnapshot(const char *bytes, size_t size);
+	bool admitMember(int id, short port, long heartbeat, long memberIncarnation);
+	void admitJoiner(int id, short port, long heartbeat, long joinIncarnation);
+	static bool isNewer(long incarnation, long heartbeat, long thanIncarnation, long thanHeartbeat);
+	long incarnationOf(MemberListEntry *entry);
+	void setVersion(MemberListEntry *entry, long heartbeat, long memberIncarnation);
+	void refuteNews(UpdateKind kind, long newsIncarnation, long newsHeartbeat);
+	void purgeTombstones();
+	void removeTombstone(int id, short port);
+	void armMemberTimer(MemberListEntry *entry);
+	void expireMemberTimers();
+	void memberTimerExpired(MemberListEntry *entry);
+	void recordTransition(MemberStatus from, MemberStatus to, long latency);
+	TransitionStats getTransitionStats(MemberStatus from, MemberStatus to);
+	void logTransitionStats();
+	static bool updateSentLess(const MembershipUpdate &first, const MembershipUpdate &second);
+	static bool updateSpent(const MembershipUpdate &update);
+	int sendPayload(SharedPayload &payload, Address *sendTo, int numTargets);
+	int sendMessage(Address *sendTo, char *data, int size);
+	int sendMessages(Address *sendTo, int numTargets, char *data, int size);
+	TrafficStats getTrafficStats();
+	long getInboxDrops();
+	void setBufferSends(bool bufferSends);
+	int flushSends();
+#ifdef MP1METRICS
+	NodeMetrics getMetrics();
+	void logMetrics();
+#endif
+#ifdef MP1BINARYLOG
+	void logRecord(LogRecordKind kind, Address *subject);
+#endif
 	void processJoinRequest();
 	void processJoinResponseRequest();
 	void mergeMyMembershipList(Member *mergeWithMember);
@@ -0,0 +1,139 @@
+/**********************************
+ * FILE NAME: MP1Udp.cpp
+ *
+ * DESCRIPTION: Runs one member as its own process over UdpTransport (Linux).
+ * 				Built like Application, from the same sources with
+ * 				MP1Udp.cpp in place of Application.cpp, e.g.
+ * 				g++ -std=c++11 -O2 -o MP1Udp MP1Udp.cpp MP1Node.cpp EmulNet.cpp Log.cpp Params.cpp Member.cpp
+ *
+ * 				MP1Udp --bind 127.0.0.1:9001 [--join 127.0.0.1:9000 ...] [--time 700] [--tick 100]
+ * 				       [--fail T] [--dir DIR]
+ * 				Every --join address is an introducer, JOINSEEDS is set to their number. The member whose --bind is the first one
+ * 				boots the group, the others join through any of them, asking the next when no
+ * 				JOINREP comes within JOINTIMEOUT ticks. The join address defaults to the bind
+ * 				address. Each tick of --tick milliseconds the process receives,
+ * 				runs nodeLoop and sends, then waits in epoll for the rest of the tick, moving
+ * 				datagrams into the inbox as they arrive. --fail T stops the member at time T without
+ * 				telling anyone, as Application fails a node. dbg.log is written in DIR, so processes
+ * 				sharing a machine each need their own. With SNAPSHOTTIME set the snapshot is kept there
+ * 				too, and a process started again in the same DIR restarts from it. At the end the process prints the members
+ * 				it lists and leaves the group through leaveGroup and finishUpThisNode. Fifty members on loopback:
+ * 				for i in $(seq 0 49); do mkdir -p n$i; ./MP1Udp --bind 127.0.0.1:$((9000 + i)) \
+ * 				    --join 127.0.0.1:9000 --dir n$i > n$i/members & sleep 0.01; done; wait
+ **********************************/
+
+#include "MP1Node.h"
+
+/**
+ * Macros
+ */
+#define UDPRUNTIME	700		// DEFAULT NUMBER OF TICKS, SAME AS APPLICATION
+#define UDPTICKMILLIS	100		// DEFAULT LENGTH OF A TICK
+
+/**
+ * FUNCTION NAME: nowMillis
+ *
+ * DESCRIPTION: Milliseconds on a clock that only moves forward
+ */
+long nowMillis() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+/**
+ * FUNCTION NAME: printMembers
+ *
+ * DESCRIPTION: One "a.b.c.d:port heartbeat" line per member in the list
+ */
+void printMembers(Member *member, int time) {
+	printf("time %d members %zu\n", time, member->memberList.size());
+	for ( unsigned int i = 0; i < member->memberList.size(); i++ ) {
+		MemberListEntry *entry = &member->memberList[i];
+		char ip[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &entry->id, ip, sizeof(ip));
+		printf("%s:%d %ld\n", ip, (unsigned short)entry->port, entry->heartbeat);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	Address bindAddress;
+	Address joinAddress;
+	vector<Address> seedAddresses;
+	bool haveBind = false;
+	int totalTime = UDPRUNTIME;
+	int tickMillis = UDPTICKMILLIS;
+	int failTime = -1;
+	bool ok = true;
+
+	for ( int i = 1; i < argc && ok; i++ ) {
+		string arg = argv[i];
+		if ( i + 1 >= argc ) ok = false;
+		else if ( arg == "--bind" ) ok = haveBind = UdpTransport::parseAddress(argv[++i], &bindAddress);
+		else if ( arg == "--join" ) {
+			ok = UdpTransport::parseAddress(argv[++i], &joinAddress);
+			seedAddresses.push_back(joinAddress);
+		}
+		else if ( arg == "--time" ) ok = (totalTime = atoi(argv[++i])) > 0;
+		else if ( arg == "--tick" ) ok = (tickMillis = atoi(argv[++i])) > 0;
+		else if ( arg == "--fail" ) ok = (failTime = atoi(argv[++i])) > 0;
+		else if ( arg == "--dir" ) ok = chdir(argv[++i]) == 0;
+		else ok = false;
+	}
+	if ( !ok || !haveBind ) {
+		cout << "usage: " << argv[0] << " --bind IP:PORT [--join IP:PORT ...] [--time T] [--tick MS] [--fail T] [--dir DIR]" << endl;
+		return 1;
+	}
+	if ( seedAddresses.empty() ) {
+		seedAddresses.push_back(bindAddress);
+	}
+
+	UdpTransport *transport = new UdpTransport();
+	if ( !transport->open(&bindAddress, seedAddresses) ) {
+		perror("bind");
+		return 1;
+	}
+	Params *par = new Params();
+	par->globaltime = 0;
+	Log *log = new Log(par);
+	Member *member = new Member;
+	MP1Node *node = new MP1Node(member, par, transport, log, &bindAddress);
+	MP1Config config = node->getConfig();
+	config.joinSeeds = (int)seedAddresses.size();
+	node->setConfig(config);
+
+	node->nodeStart((char *)"", *(short *)(&bindAddress.addr[4]));
+	transport->flush();
+	long deadline = nowMillis();
+	for ( par->globaltime = 1; par->globaltime < totalTime; ++par->globaltime ) {
+		if ( par->getcurrtime() == failTime ) {
+			member->bFailed = true;
+			break;
+		}
+		node->recvLoop();
+		node->nodeLoop();
+		transport->flush();
+
+		deadline += tickMillis;
+		for ( long left = deadline - nowMillis(); left > 0; left = deadline - nowMillis() ) {
+			if ( transport->wait(left) ) {
+				node->recvLoop();
+			}
+		}
+	}
+
+	printMembers(member, par->getcurrtime());
+	if ( transport->getDropped() > 0 || node->getInboxDrops() > 0 ) {
+		printf("dropped %ld sends, %ld receives\n", transport->getDropped(), node->getInboxDrops());
+	}
+	if ( !member->bFailed ) {
+		node->leaveGroup();
+		node->finishUpThisNode();
+	}
+	delete node;
+	delete member;
+	delete log;
+	delete transport;
+	delete par;
+	return 0;
+}